@@ -30,6 +30,11 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <ctype.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 #include "triadicmemory.h"
 
@@ -400,8 +405,44 @@ SDR* dyadicmemory_read (DyadicMemory *D, SDR *x, SDR *y)
 
 // ---------- Triadic Memory -- stores triple associations (x,y,z}  ----------
 
+
+// storage cube backed by 2 MB pages (Linux): explicit huge pages from the hugetlbfs pool,
+// or else transparent huge pages, or else 0 for the default allocation
+
+#define HUGEPAGE_BYTES	((size_t) 2 << 20)
+
+enum { BACKING_DEFAULT, BACKING_TRANSPARENT, BACKING_HUGETLB };
+
+static TMEMTYPE* hugepages_alloc (size_t bytes, int *backing)
+	{
+#if defined(__linux__) && defined(MAP_HUGETLB) && defined(MADV_HUGEPAGE)
+	size_t size = (bytes + HUGEPAGE_BYTES - 1) / HUGEPAGE_BYTES * HUGEPAGE_BYTES;
 	
-TriadicMemory *triadicmemory_new(int n, int p)
+	void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		{
+		*backing = BACKING_HUGETLB;
+		return (TMEMTYPE*) p;
+		}
+	
+	// transparent huge pages only cover 2 MB aligned ranges
+	p = mmap(0, size + HUGEPAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED)
+		{
+		char *aligned = (char*) (((uintptr_t) p + HUGEPAGE_BYTES - 1) & ~(HUGEPAGE_BYTES - 1));
+		if (madvise(aligned, size, MADV_HUGEPAGE) == 0)
+			{
+			*backing = BACKING_TRANSPARENT;
+			return (TMEMTYPE*) aligned;
+			}
+		munmap(p, size + HUGEPAGE_BYTES);
+		}
+#endif
+	return 0;
+	}
+	
+
+static TriadicMemory *tm_new(int n, int p, int hugepages)
 	{
 	srand_init();
 	
@@ -412,16 +453,39 @@ TriadicMemory *triadicmemory_new(int n, int p)
 	T->nz = n;
 	T->p = p;
 	T->forgetting = 0; // forgetting is an experimental feature, disabled by default
+	T->backing = BACKING_DEFAULT;
 	
 	// allocate and initialize the entire storage cube
 	// limitation: malloc may fail for large n, use virtual memory instead in this case
 	// note: using calloc instead of malloc would decrease write performance
-	T->C = (TMEMTYPE*) malloc( T->nx * T->ny * T->nz * sizeof(TMEMTYPE));
-	for (int i = 0; i < T->nx * T->ny * T->nz; i++) *(T->C + i) = 0;
+	
+	T->C = hugepages ? hugepages_alloc( (size_t) T->nx * T->ny * T->nz * sizeof(TMEMTYPE), &T->backing) : 0;
+	
+	if (! T->C) // mapped pages are already zero
+		{
+		T->C = (TMEMTYPE*) malloc( T->nx * T->ny * T->nz * sizeof(TMEMTYPE));
+		for (int i = 0; i < T->nx * T->ny * T->nz; i++) *(T->C + i) = 0;
+		}
 	
 	return T;
 	}
 	
+TriadicMemory *triadicmemory_new(int n, int p)
+	{
+	return tm_new(n, p, 0);
+	}
+	
+TriadicMemory *triadicmemory_new_hugepages(int n, int p)
+	{
+	return tm_new(n, p, 1);
+	}
+	
+const char* triadicmemory_backing (TriadicMemory *T)
+	{
+	static const char *names[] = { "4 KB pages", "transparent huge pages", "huge pages" };
+	return names[T->backing];
+	}
+	
 void triadicmemory_write (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
 	{
 	int n = T->nz, nn = T->ny * T->nz;
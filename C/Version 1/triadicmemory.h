@@ -94,11 +94,15 @@ typedef struct
 		nz,		// dimension of z
 		p,		// target sparse population
 		
-		forgetting; 	// whether to erase older information (off by default)
+		forgetting, 	// whether to erase older information (off by default)
+		backing;	// pages obtained for the storage cube, see triadicmemory_backing
 
 	} TriadicMemory;
 
 TriadicMemory *triadicmemory_new(int n, int p);
+TriadicMemory *triadicmemory_new_hugepages(int n, int p);	// storage cube backed by 2 MB pages if available (Linux)
+
+const char* triadicmemory_backing (TriadicMemory *);		// "4 KB pages", "transparent huge pages" or "huge pages"
 
 void triadicmemory_write   (TriadicMemory *, SDR *, SDR *, SDR *);
 void triadicmemory_delete  (TriadicMemory *, SDR *, SDR *, SDR *);
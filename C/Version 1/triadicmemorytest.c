@@ -42,16 +42,18 @@ int main(int argc, char *argv[])
     	int size 		= 100000;
     	int iterations 		= 25;
     	int tridirectional 	= 1;
+    	int hugepages		= argc > 1 ? atoi(argv[1]) : 0;	// 1 for 2 MB page backing, to compare with 4 KB pages
 
   	clock_t start;
  
-   	TriadicMemory *T = triadicmemory_new(N, P);
+   	TriadicMemory *T = hugepages ? triadicmemory_new_hugepages(N, P) : triadicmemory_new(N, P);
    	
    	T->forgetting = 0; // set to 1 to enable forgetting mode
   	
 	printf("Triadic Memory capacity and performance tests\n");
 	printf("Recall errors are given as the average Hamming distance\n");
 	printf("Forgetting = %d\n", T->forgetting);
+	printf("Storage backed by %s\n", triadicmemory_backing(T));
 	
 	printf("N = %d, P = %d\n\n", N, P);
 
@@ -33,7 +33,7 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 
 static int VERSIONMAJOR = 2;
-static int VERSIONMINOR = 0;
+static int VERSIONMINOR = 1;
 
 
 static void print_help(void)
@@ -45,7 +45,9 @@ static void print_help(void)
 	printf("\n");
 	printf("Command line arguments:\n\n");
 	printf("dyadicmemory n p             (n is the dimension of x and y, p is the target sparse population of y)\n");
-	printf("dyadicmemory nx ny p         (nx and ny are the dimensions of x and y, p is the target sparse population of y)\n\n");
+	printf("dyadicmemory nx ny p         (nx and ny are the dimensions of x and y, p is the target sparse population of y)\n");
+	printf("dyadicmemory -b ...          (binary protocol on stdin and stdout, see README.md, instead of the text input below)\n");
+	printf("dyadicmemory -f file ...     (batch mode: processes the lines of a file, or of stdin if file is -, at full speed)\n\n");
 		
 		
 	printf("Usage examples:\n\n");
@@ -55,6 +57,21 @@ static void print_help(void)
 	printf("Recall y for a given x:\n");
 	printf("1 20 195 355 371 471 603  814 911 999\n\n");
 		
+	printf("Recall y and print the id of the nearest stored item (#k prints the ids of the k nearest items, best first):\n");
+	printf("1 20 195 355 371 471 603  814 911 999, #\n\n");
+	
+	printf("Store an item with id 17, a vector y to which query results can be mapped by #:\n");
+	printf("#17: 13 29 41 182 590 711 714 773 925 967\n\n");
+	
+	printf("Remove item 17:\n");
+	printf("-#17\n\n");
+	
+	if (TM_CELLBITS > 1) // deleting needs counters, 1-bit cells are shared by other associations
+		{
+		printf("Delete x->y from memory:\n");
+		printf("- 1 20 195 355 371 471 603  814 911 999, 13 29 41 182 590 711 714 773 925 967\n\n");
+		}
+		
 	printf("Print this help text:\n");
 	printf("help\n\n");
 	
@@ -67,11 +84,295 @@ static void print_help(void)
 	
 	
 
+static void print_items (ItemMemory *I, SDR *s, int k) // ids of the k items nearest to s, best first
+	{
+	if (k > I->nitems) k = I->nitems; // no more ids than items
+	if (k < 0) k = 0;
+	
+	int *ids = malloc((k ? k : 1) * sizeof(int)), *overlaps = malloc((k ? k : 1) * sizeof(int));
+	if (! ids || ! overlaps)
+		{ printf("out of memory\n"); exit(6); }
+		
+	int found = itemmemory_query(I, s, k, ids, overlaps);
+	
+	for (int i = 0; i < found; i++)
+		printf(i ? " %d" : "%d", ids[i]);
+	printf("\n");
+	fflush(stdout);
+	
+	free(ids);
+	free(overlaps);
+	}
+
+
+static void serve (DyadicMemory *D, ItemMemory *I, SDR *x, SDR *y) // binary protocol
+	{
+	Channel *C = channel_new(0, 1);
+	
+	while (channel_receive(C))
+		{
+		int op = C->code, ok = 1;
+		uint32_t k = 1, id = 0;
+		
+		// parse the request
+		
+		if (op == OP_DELETE && TM_CELLBITS == 1)
+			{
+			channel_error(C, "delete needs counter cells (TM_CELLBITS > 1)");
+			continue;
+			}
+			
+		if (op == OP_WRITE || op == OP_DELETE)
+			ok = channel_get_sdr(C, x) && channel_get_sdr(C, y);
+			
+		else if (op == OP_READ_Y || op == OP_ITEMS_Y)
+			ok = (op == OP_READ_Y || channel_get_uint(C, &k)) && channel_get_sdr(C, x);
+			
+		else if (op == OP_ITEM_STORE || op == OP_ITEM_REMOVE)
+			{
+			ok = channel_get_uint(C, &id) && id <= 1 << 30;
+			if (ok && op == OP_ITEM_STORE) ok = channel_get_sdr(C, y);
+			}
+			
+		else if (op != OP_SYNC)
+			{
+			channel_error(C, "unknown opcode");
+			continue;
+			}
+			
+		if (! ok || C->p != C->end)
+			{
+			channel_error(C, "invalid request");
+			continue;
+			}
+			
+		// execute it
+		
+		if (op == OP_WRITE)
+			dyadicmemory_write (D, x, y);
+			
+		else if (op == OP_DELETE)
+			dyadicmemory_delete (D, x, y);
+			
+		else if (op == OP_READ_Y)
+			{
+			dyadicmemory_read (D, x, y);
+			channel_begin(C, C->id, STATUS_OK);
+			channel_put_sdr(C, y);
+			channel_end(C);
+			}
+			
+		else if (op == OP_ITEMS_Y) // ids of the k items nearest to y
+			{
+			dyadicmemory_read (D, x, y);
+			if (k > (uint32_t) I->nitems) k = I->nitems;
+			
+			int *ids = malloc((k ? k : 1) * sizeof(int)), *overlaps = malloc((k ? k : 1) * sizeof(int));
+			
+			if (! ids || ! overlaps)
+				channel_error(C, "out of memory");
+			else
+				{
+				int found = itemmemory_query(I, y, k, ids, overlaps);
+				
+				channel_begin(C, C->id, STATUS_OK);
+				channel_put_uint(C, found);
+				for (int i = 0; i < found; i++)
+					channel_put_uint(C, ids[i]);
+				channel_end(C);
+				}
+				
+			free(ids);
+			free(overlaps);
+			}
+			
+		else if (op == OP_ITEM_STORE)
+			itemmemory_insert(I, id, y);
+			
+		else if (op == OP_ITEM_REMOVE)
+			itemmemory_remove(I, id);
+			
+		else // OP_SYNC
+			{
+			channel_begin(C, C->id, STATUS_OK);
+			channel_end(C);
+			}
+		}
+		
+	channel_delete(C);
+	}
+
+
+static DyadicMemory *D;
+static ItemMemory *I;
+static SDR *x, *y;
+static int Nx, Ny, P;  // vector dimension and target sparse population
+
+
+static int execute (char *inputline) // process a line of input, 0 for quit
+	{
+	char *buf;
+	
+	if ( strcmp(inputline, "quit\n") == 0)
+		return 0;
+
+	if ( strcmp(inputline, "version\n") == 0)
+		printf("%d.%d\n", VERSIONMAJOR, VERSIONMINOR);
+
+	else if ( strcmp(inputline, "help\n") == 0)
+		print_help();
+
+	else if (*inputline == ITEMQUERY || ! strncmp(inputline, "-#", 2)) // store or remove an item
+		{
+		int delete = *inputline == '-';
+		buf = inputline + delete + 1;
+		long id = strtol(buf, &buf, 10);
+		
+		if (buf == inputline + delete + 1 || id < 0 || id > 1 << 30)
+			{
+			printf("invalid item id\n");
+			exit(5);
+			}
+		
+		if (delete)
+			itemmemory_remove(I, id);
+		else if (*buf == ':')
+			{
+			sdr_parse(buf+1, y);
+			itemmemory_insert(I, id, y);
+			}
+		else
+			{
+			printf("invalid input\n");
+			exit(5);
+			}
+		}
+		
+	else // parse x
+		{
+		int delete = 0;
+		
+		if (*inputline == '-')
+			delete = 1;
+			
+		if (delete && TM_CELLBITS == 1)
+			{
+			printf("invalid input, delete needs counter cells (TM_CELLBITS > 1)\n");
+			exit(5);
+			}
+		
+		buf = sdr_parse(inputline + delete, x);
+		
+		char *q = buf + (*buf == SEPARATOR);
+		while (isspace(*q)) q++;
+		
+		if (*buf == SEPARATOR && *q == ITEMQUERY && ! delete) // query returning item ids, #k for the k nearest items
+			{
+			char *end;
+			int k = strtol(++q, &end, 10);
+			if (end == q) k = 1;
+			
+			while (isspace(*end)) end++;
+			if (*end)
+				{
+				printf("invalid input\n");
+				exit(5);
+				}
+				
+			dyadicmemory_read (D, x, y);
+			print_items(I, y, k);
+			}
+			
+		else if (*buf == SEPARATOR) // parse y
+			{
+			sdr_parse(buf+1, y);
+			
+			// store or delete x->y
+			if (delete)
+				dyadicmemory_delete (D, x,y);
+			else
+				dyadicmemory_write (D, x,y);
+			}
+			
+		else if (*buf == 0) // query
+			{
+			dyadicmemory_read (D, x, y);
+			sdr_print(y);
+			}
+		else
+			{
+			printf("invalid input\n");
+			exit(5);
+			}
+		}
+	
+	return 1;
+	}
+	
+	
+// batch mode: plain writes and reads are parsed by sdr_scan and their results formatted into the output buffer,
+// all other lines go to execute
+
+static int run (const char *line, const char *end, char *text) // 0 for lines other than plain writes and reads
+	{
+	if (! (line = sdr_scan(line, end, x))) return 0;
+	
+	if (line == end) // read
+		{
+		dyadicmemory_read (D, x, y);
+		fwrite(text, 1, sdr_format(text, y) - text, stdout);
+		return 1;
+		}
+		
+	if (*line != SEPARATOR || ! (line = sdr_scan(line + 1, end, y)) || line != end)
+		return 0;
+		
+	dyadicmemory_write (D, x, y);
+	return 1;
+	}
+	
+	
+static void batch (const char *path)
+	{
+	TextInput *in = textinput_open(path);
+	if (! in) { perror(path); exit(1); }
+	
+	setvbuf(stdout, 0, _IOFBF, 1 << 22);
+	
+	char *line, *end, *copy = 0, *text = malloc(11 * Ny + 1);
+	size_t size = 0;
+	
+	while ((line = textinput_line(in, &end)))
+		{
+		if (run(line, end, text)) continue;
+		
+		size_t len = end - line;
+		
+		if (len + 1 > size) copy = realloc(copy, size = 2 * (len + 1));
+		memcpy(copy, line, len);
+		copy[len] = 0;
+		
+		if (! execute(copy)) break;
+		}
+		
+	textinput_close(in);
+	}
+
+
 int main(int argc, char *argv[])
 	{
-	char *buf, inputline[10000];
+	char inputline[10000], *file = 0;
+	int binary = 0;
 	
-	int Nx, Ny, P;  // vector dimension and target sparse population
+	for (; argc > 3 && *argv[1] == '-'; argc--, argv++) // options
+		{
+		if (! strcmp(argv[1], "-b"))
+			binary = 1;
+		else if (! strcmp(argv[1], "-f"))
+			{ file = argv[2]; argc--; argv++; }
+		else
+			break;
+		}
 	
 	if (argc == 3)
 		{
@@ -91,50 +392,20 @@ int main(int argc, char *argv[])
 		exit(1);
 		}
 		
-	if (Nx > NMAX)
-		{
-		printf("vector dimension %d exceeds maximum value %d\n", Nx, NMAX);
-		exit(20);
-		}
-    
-	SDR *x = sdr_new(Nx);
-	SDR *y = sdr_new(Ny);
+	x = sdr_new(Nx);
+	y = sdr_new(Ny);
 	
-	DyadicMemory *D = dyadicmemory_new(Nx, Ny, P);
-
-	while (	fgets(inputline, sizeof(inputline), stdin) != NULL)
-		{
-		if ( strcmp(inputline, "quit\n") == 0)
-			return 0;
-
-		if ( strcmp(inputline, "version\n") == 0)
-			printf("%d.%d\n", VERSIONMAJOR, VERSIONMINOR);
-
-		else if ( strcmp(inputline, "help\n") == 0)
-			print_help();
-
-		else // parse x
-			{
-			buf = sdr_parse(inputline, x);
-			
-			if (*buf == SEPARATOR) // parse y
-				{
-				sdr_parse(buf+1, y);
-				dyadicmemory_write (D, x,y);
-				}
-				
-			else if (*buf == 0) // query
-				{
-				dyadicmemory_read (D, x, y);
-				sdr_print(y);
-				}
-			else
-				{
-				printf("invalid input\n");
-				exit(5);
-				}
-			}
-		}
+	D = dyadicmemory_new(Nx, Ny, P);
+	I = itemmemory_new(Ny);
+	
+	if (binary)
+		serve(D, I, x, y);
+		
+	else if (file)
+		batch(file);
+		
+	else while (fgets(inputline, sizeof(inputline), stdin) != NULL && execute(inputline))
+		;
 	
 	return 0;
 	}
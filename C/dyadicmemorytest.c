@@ -51,17 +51,22 @@ int main(int argc, char *argv[])
 	
    	DyadicMemory *T = dyadicmemory_new(Nx, Ny, P);
   	
-	printf("Dyadic Memory performance and capacity test\n");
+	printf("Dyadic Memory performance and capacity test, %s kernels\n", triadicmemory_simd());
 	
 	SDR **t1 	= malloc(items * sizeof(SDR*));
 	SDR **t2 	= malloc(items * sizeof(SDR*));
 	SDR **out 	= malloc(items * sizeof(SDR*));
 
+	// the test data pools hold 4 bytes per position instead of 4 bytes per dimension
+	SDRPool *xdata = sdrpool_new(Nx, items, P);
+	SDRPool *ydata = sdrpool_new(Ny, items, P);
+	SDRPool *results = sdrpool_new(Ny, items, Ny);	// room for all Ny positions, a read is never truncated
+
 	for (int i = 0; i < items; i++)
 		{
-		t1[i] = sdr_new(Nx);
-		t2[i] = sdr_new(Ny);
-		out[i]= sdr_new(Ny);
+		t1[i] = xdata->sdr + i;
+		t2[i] = ydata->sdr + i;
+		out[i]= results->sdr + i;
 		}
 		
 	for ( int iter = 1; iter <= iterations; iter ++)
@@ -0,0 +1,188 @@
+/*
+sdrtest.c
+
+Performance test of the SDR set operations, compared to plain merge loops
+
+
+Copyright (c) 2022-2024 Peter Overmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+and associated documentation files (the “Software”), to deal in the Software without restriction,
+including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial
+portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "triadicmemory.h"
+
+
+// merge loops of the former implementation, as reference
+
+static int merge_overlap (SDR *x, SDR *y)
+	{
+	int i = 0, j = 0, overlap = 0;
+
+	while (i < x->p && j < y->p )
+		{
+		if (x->a[i] == y->a[j])
+			{ ++overlap; i++; j++; }
+		else if (x->a[i] < y->a[j]) ++i;
+		else ++j;
+		}
+
+	return overlap;
+	}
+
+static int merge_distance (SDR *x, SDR *y)
+	{
+	return x->p + y->p - 2 * merge_overlap(x, y);
+	}
+
+static int merge_equal (SDR *x, SDR *y)
+	{
+	if ( x->p != y->p) return 0;
+
+	for (int i = 0; i < x->p; i++)
+		if (x->a[i] != y->a[i]) return 0;
+
+	return 1;
+	}
+
+static SDR *merge_or (SDR *res, SDR *x, SDR *y)
+	{
+	int i = 0, j = 0;
+	res->p = 0;
+
+	while (i < x->p || j < y->p )
+		{
+		if (i == x->p) while (j < y->p)
+			res->a[ res->p++] = y->a[j++];
+
+		else if (j == y->p) while (i < x->p)
+			res->a[ res->p++] = x->a[i++];
+
+		else if (x->a[i] < y->a[j] )
+			res->a[ res->p++] = x->a[i++];
+
+		else if (x->a[i] > y->a[j] )
+			res->a[ res->p++] = y->a[j++];
+
+		else
+			{ res->a[ res->p++] = x->a[i]; i++; j++; }
+		}
+
+	return res;
+	}
+
+static SDR *merge_and (SDR *res, SDR *x, SDR *y)
+	{
+	int i = 0, j = 0;
+	res->p = 0;
+
+	while (i < x->p && j < y->p )
+		{
+		if (x->a[i] == y->a[j])
+			{ res->a[ res->p++] = x->a[i]; i++; j++; }
+		else if (x->a[i] < y->a[j]) ++i;
+		else ++j;
+		}
+
+	return res;
+	}
+
+
+
+#define PAIRS	4096	// pairs of SDRs per test, reused across rounds
+#define ROUNDS	200
+
+static SDR *R;
+static long checksum;
+
+
+// nanoseconds per call of f for all pairs (x[i], y[i])
+
+static double timed (int (*f) (SDR *, SDR *), SDR **x, SDR **y)
+	{
+	clock_t start = clock();
+
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < PAIRS; i++)
+			checksum += f(x[i], y[i]);
+
+	return 1e9 * (double) (clock() - start) / CLOCKS_PER_SEC / ROUNDS / PAIRS;
+	}
+
+static int sdr_or_p (SDR *x, SDR *y) 	{ return sdr_or(R, x, y)->p; }
+static int merge_or_p (SDR *x, SDR *y) 	{ return merge_or(R, x, y)->p; }
+
+
+int main(void)
+	{
+	int N = 1000;					// SDR dimension
+	int P[][2] = { {5,5}, {10,10}, {20,20}, {40,40}, {10,200} };	// populations of x and y
+	int tests = sizeof P / sizeof P[0];
+
+	Random rng;
+	random_seed(&rng, 1);
+
+	SDR **X = malloc(PAIRS * sizeof(SDR*));
+	SDR **Y = malloc(PAIRS * sizeof(SDR*));
+	SDR **Z = malloc(PAIRS * sizeof(SDR*));	// copies of X, for testing equality
+	R = sdr_new(N);
+	SDR *S = sdr_new(N);				// results of the merge loops
+
+	for (int i = 0; i < PAIRS; i++)
+		{
+		X[i] = sdr_new(N);
+		Y[i] = sdr_new(N);
+		Z[i] = sdr_new(N);
+		}
+
+	printf("SDR set operations performance test, %s kernels, ns per call (merge loop / new)\n", triadicmemory_simd());
+
+	for (int t = 0; t < tests; t++)
+		{
+		for (int i = 0; i < PAIRS; i++)
+			{
+			sdr_random_r(X[i], P[t][0], &rng);
+			sdr_noise_r(sdr_set(Y[i], X[i]), -P[t][0] / 2, &rng);	// y shares about half the bits of x
+			sdr_noise_r(Y[i], P[t][1] - Y[i]->p, &rng);
+			sdr_set(Z[i], X[i]);
+
+			if (sdr_overlap(X[i], Y[i]) != merge_overlap(X[i], Y[i])
+				|| sdr_distance(X[i], Y[i]) != merge_distance(X[i], Y[i])
+				|| sdr_equal(X[i], Z[i]) != merge_equal(X[i], Z[i])
+				|| sdr_equal(X[i], Y[i]) != merge_equal(X[i], Y[i])
+				|| ! merge_equal(sdr_or(R, X[i], Y[i]), merge_or(S, X[i], Y[i]))
+				|| ! merge_equal(sdr_and(R, X[i], Y[i]), merge_and(S, X[i], Y[i])))
+				{
+				printf("results differ\n");
+				exit(1);
+				}
+			}
+
+		printf("| n=%d | p=%d,%d | ", N, P[t][0], P[t][1]);
+		printf("overlap %.1f / %.1f | ", timed(merge_overlap, X, Y), timed(sdr_overlap, X, Y));
+		printf("distance %.1f / %.1f | ", timed(merge_distance, X, Y), timed(sdr_distance, X, Y));
+		printf("equal %.1f / %.1f | ", timed(merge_equal, X, Z), timed(sdr_equal, X, Z));
+		printf("or %.1f / %.1f |\n", timed(merge_or_p, X, Y), timed(sdr_or_p, X, Y));
+		}
+
+	printf("\nfinished (%ld)\n", checksum);
+	return 0;
+	}
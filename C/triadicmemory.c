@@ -6,8 +6,8 @@ C-language implementation of Triadic Memory and related algorithms published in
 
    https://github.com/PeterOvermann/Writings/blob/main/TriadicMemory.pdf
    
-This version is based on 1-bit storage locations, as opposed to the reference implementation
-which is based on 8-bit memory counters.
+This version is based on 1-bit storage locations by default, as opposed to the reference implementation
+which is based on 8-bit memory counters. Counters of 2, 4 or 8 bits can be selected with TM_CELLBITS.
 
 Copyright (c) 2022-2024 Peter Overmann
 
@@ -28,156 +28,487 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 
+#if defined(__linux__)
+#define _GNU_SOURCE	// pthread_setaffinity_np, syscall
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 
 #include "triadicmemory.h"
 
 
 
+// ---------- CPU feature dispatch ----------
+
+// Hot kernels are compiled in several variants for different x86 instruction set levels.
+// The best level supported by the processor is selected once at program startup, see select_kernels
+// at the end of this file. The environment variable TRIADICMEMORY_SIMD (portable, avx2 or avx512)
+// caps the level, e.g. for benchmarking. Other architectures use the portable variants only.
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+#define X86_DISPATCH
+
+#define TARGET_AVX2	__attribute__((target("avx2,bmi,bmi2,popcnt,lzcnt")))
+#define TARGET_AVX512	__attribute__((target("avx2,bmi,bmi2,popcnt,lzcnt,avx512f,avx512bw,avx512vl,avx512dq")))
+
+// compile the inline kernel name for each level, the variants are named name_64, name_avx2 and name_avx512
+
+#define KERNEL_VARIANTS(type, name, params, call) \
+	static type name##_64 params { call; } \
+	TARGET_AVX2 static type name##_avx2 params { call; } \
+	TARGET_AVX512 static type name##_avx512 params { call; }
+
+#else
+
+#define KERNEL_VARIANTS(type, name, params, call) \
+	static type name##_64 params { call; }
+
+#endif
+
+#define KERNEL static inline __attribute__((always_inline))
+
+
+enum { SIMD_PORTABLE, SIMD_AVX2, SIMD_AVX512 };
+
+static struct
+	{
+	int level;
+	
+	SDR* (*binarize) 		(SDR *, int *, int, Workspace *);
+	SDR* (*sdr_or) 			(SDR *, SDR *, SDR *);
+	SDR* (*sdr_and) 		(SDR *, SDR *, SDR *);
+	int  (*overlap)			(const int *, int, const int *, int);
+	int  (*bits_combine)		(word *, const word *, const word *, int, int);
+	int  (*collect_counts)		(uint16_t *, int, int *);
+	
+	void (*accumulate_rows) 	(word **, int, size_t, int, int, int *);
+	void (*accumulate_strided)	(word *, size_t, size_t, size_t, int, int *);
+	void (*tm_write)		(TriadicMemory *, SDR *, SDR *, SDR *);
+	void (*tm_delete)		(TriadicMemory *, SDR *, SDR *, SDR *);
+	
+	} K; // kernels selected at startup
+
+
+
+
+// ---------- Query workspaces ----------
+
+// A workspace holds the scratch buffers of a query. Buffers grow as needed and are then reused,
+// so that queries on a long-lived workspace do not allocate memory.
+
+
+Workspace *workspace_new (void)
+	{
+	return (Workspace*) calloc(1, sizeof(Workspace));
+	}
+	
+void workspace_delete (Workspace *W)
+	{
+	free(W->response);
+	free(W->rows);
+	free(W->hist);
+	free(W->counts);
+	free(W->cursors);
+	free(W);
+	}
+	
+	
+static void* grow (void *buf, int *capacity, int needed, size_t size)
+	{
+	if (needed < 1) needed = 1;
+	if (needed <= *capacity) return buf;
+	
+	free(buf); // contents need not be preserved
+	*capacity = needed > 2 * *capacity ? needed : 2 * *capacity;
+	return malloc(*capacity * size);
+	}
+
+static int* workspace_response (Workspace *W, int n) // response vector of n zeros
+	{
+	W->response = (int*) grow(W->response, &W->nresponse, n, sizeof(int));
+	memset(W->response, 0, n * sizeof(int));
+	return W->response;
+	}
+
+static word** workspace_rows (Workspace *W, int n)
+	{
+	return W->rows = (word**) grow(W->rows, &W->nrows, n, sizeof(word*));
+	}
+
+static int* workspace_hist (Workspace *W, int n)
+	{
+	return W->hist = (int*) grow(W->hist, &W->nhist, n, sizeof(int));
+	}
+	
+	
+// workspace used by the query functions without a workspace argument, one per thread
+// (created on first use, deleted by the key destructor when the thread terminates)
+
+static pthread_key_t workspace_key;
+static pthread_once_t workspace_once = PTHREAD_ONCE_INIT;
+
+static void workspace_destructor (void *W)
+	{
+	workspace_delete((Workspace*) W);
+	}
+
+static void workspace_key_create (void)
+	{
+	pthread_key_create(&workspace_key, workspace_destructor);
+	}
+
+static Workspace *default_workspace (void)
+	{
+	pthread_once(&workspace_once, workspace_key_create);
+	
+	Workspace *W = (Workspace*) pthread_getspecific(workspace_key);
+	if (! W)
+		{
+		W = workspace_new();
+		pthread_setspecific(workspace_key, W);
+		}
+	return W;
+	}
+
+
 
 // ---------- SDR utility functions ----------
 
 
-static int cmpfunc (const void * a, const void * b)
-	{ return  *(int*)a - *(int*)b; }
+#define SDR_WORDS(s)	(((s)->n + 63) / 64)	// words of the bitmap of a dense SDR
+
+// rebuild the bitmap of a dense SDR from its positions, called by all functions writing to an SDR
+
+static void sdr_update_bits (SDR *s)
+	{
+	if (! s->bits) return;
 	
+	memset(s->bits, 0, SDR_WORDS(s) * sizeof(word));
+	for (int i = 0; i < s->p; i++)
+		s->bits[s->a[i] / 64] |= 1ull << s->a[i] % 64;
+	}
 	
+
 // convert an array of non-negative integers v to an SDR x with target sparse population pop
 // this is used by dyadic/triadic memory query functions
 
-static SDR* binarize (SDR *x, int *response, int pop)
+// the threshold is the pop-th largest response value, found by counting how often each value occurs
+// (response values are small integers, bounded by the number of storage rows added up by the query)
+
+KERNEL SDR* binarize_kernel (SDR *x, int *response, int pop, Workspace *W)
 	{
-	int *sorted = (int *)malloc(x->n * sizeof(int)), rankedmax;
+	int maxval = 0, rankedmax = 0, count = 0;
 	
-	for ( int i=0; i < x->n; i++ )
-		sorted[i] = response[i];
+	for ( int i = 0; i < x->n; i++ )
+		if (response[i] > maxval) maxval = response[i];
+		
+	int *hist = workspace_hist(W, maxval + 1);
 	
-	qsort( sorted, x->n, sizeof(int), cmpfunc);
+	for ( int v = 0; v <= maxval; v++ )
+		hist[v] = 0;
+		
+	for ( int i = 0; i < x->n; i++ )
+		hist[response[i]] ++;
 	
-	rankedmax = sorted[ x->n - pop ];
+	for ( int v = maxval; v >= 0; v-- )
+		if ( (count += hist[v]) >= pop )
+			{ rankedmax = v; break; }
 	
 	if(rankedmax == 0)
 		rankedmax = 1;
 		
 	x->p = 0;
-	for ( int i = 0; i < x->n; i++)
+	for ( int i = 0; i < x->n && x->p < x->cap; i++)
 		if (response[i] >= rankedmax)
 			x->a[x->p++] = i;
 
-	free(sorted);
-	free(response);	//  was calloc'ed by the calling function
+	return x;
+	}
+	
+KERNEL_VARIANTS (SDR*, binarize_kernel, (SDR *x, int *response, int pop, Workspace *W),
+	return binarize_kernel(x, response, pop, W))
 
+static SDR* binarize (SDR *x, int *response, int pop, Workspace *W)
+	{
+	K.binarize(x, response, pop, W);
+	sdr_update_bits(x);
 	return x;
 	}
 
 
 
-static void srand_init(void)
+// ---------- Random generator ----------
+
+// xoshiro256** (Blackman and Vigna), seeded through splitmix64
+// each thread has its own generator for sdr_random and sdr_noise, other generators can be passed explicitly
+
+static inline uint64_t splitmix64 (uint64_t *s)
+	{
+	uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+	}
+	
+static inline uint64_t rotl (uint64_t x, int k)
+	{
+	return (x << k) | (x >> (64 - k));
+	}
+
+void random_seed (Random *R, uint64_t seed)
+	{
+	for (int i = 0; i < 4; i++)
+		R->s[i] = splitmix64(&seed);
+	}
+	
+uint64_t random_next (Random *R)
+	{
+	uint64_t *s = R->s, result = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+	
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	
+	return result;
+	}
+	
+Random *random_thread (void)
 	{
-	static int initialized = 0;
-	if (! initialized)
+	static _Thread_local Random R;
+	static _Thread_local int seeded = 0;
+	
+	if (! seeded) // different seeds for threads started at the same time
 		{
-		srand((unsigned int)time(NULL)); initialized = 1;
+		random_seed(&R, (uint64_t) time(NULL) ^ (uint64_t) (uintptr_t) &R);
+		seeded = 1;
 		}
+		
+	return &R;
 	}
 	
-
-SDR* sdr_random( SDR*s, int p) // fill s with p random bits (in place)
+static inline double random_exponential (Random *R) // exponentially distributed, mean 1
 	{
-	srand_init();
+	return -log( ((double) (random_next(R) >> 11) + 0.5) * 0x1p-53);
+	}
 	
-	int n = s->n;
-	s->p = p;
+	
+// random positions are added to an SDR by drawing positions independently, in rounds, until the requested
+// number of distinct positions was drawn -- this yields a uniformly random subset, however the rounds are split
+// each round is generated in sorted order from exponential spacings (cumulative sums of exponentially
+// distributed numbers, divided by their total, are sorted uniform numbers) and merged into the SDR,
+// so that neither a sort nor an allocation is needed, and a round of p positions takes O(p) time
+// positions drawn so far are flagged with DRAWN, to recognize repeated draws of a position
 
-	int* range = (int*)malloc(n * sizeof(int));
+#define SAMPLE_ROUND	256		// maximum positions per round
+#define DRAWN		(1u << 31)
 
-	for (int i = 0; i < n; i++) range[i] = i; // initialize with integers 0 to n-1
+static void sdr_sample (SDR *s, int bits, Random *R)
+	{
+	unsigned int *a = (unsigned int*) s->a, v[SAMPLE_ROUND];
+	double e[SAMPLE_ROUND + 1];
+	int n = s->n, drawn = 0;
 	
-	for (int k = 0; k < p; k++) // random selection of p integers in the range 0 to n-1
+	if (bits > n) bits = n;
+	if (bits > s->cap - s->p) bits = s->cap - s->p;
+	
+	while (drawn < bits)
 		{
-		int r = rand() % n;
-		s->a[k] = range[r];
-		int tmp = range[n-1]; range[n-1] = range[r]; range[r] = tmp; // swap selected value to the end
-		n--; // values swapped to the end won't get picked again
+		int k = bits - drawn < SAMPLE_ROUND ? bits - drawn : SAMPLE_ROUND, m = 0, u = s->p;
+		double sum = 0;
+		
+		for (int i = 0; i <= k; i++)
+			e[i] = sum += random_exponential(R);
+			
+		for (int i = 0; i < k; i++) // sorted positions, without repetitions within the round
+			{
+			unsigned int pos = (unsigned int) (e[i] / sum * n);
+			if (pos >= (unsigned int) n) pos = n - 1; // rounding
+			if (m == 0 || v[m-1] != pos) v[m++] = pos;
+			}
+			
+		for (int i = 0, j = 0; j < m; j++) // u: size after the merge
+			{
+			while (i < s->p && (a[i] & ~DRAWN) < v[j]) i++;
+			if (i == s->p || (a[i] & ~DRAWN) != v[j]) u++;
+			}
+			
+		for (int i = s->p - 1, j = m - 1, w = u - 1; j >= 0; j--) // merge from the back, in place
+			{
+			while (i >= 0 && (a[i] & ~DRAWN) > v[j]) a[w--] = a[i--];
+			
+			if (i >= 0 && (a[i] & ~DRAWN) == v[j]) // position is set already
+				{
+				if (! (a[i] & DRAWN)) { a[i] |= DRAWN; drawn++; }
+				a[w--] = a[i--];
+				}
+			else	{
+				a[w--] = v[j] | DRAWN;
+				drawn++;
+				}
+			}
+			
+		s->p = u;
 		}
+		
+	for (int i = 0; i < s->p; i++)
+		a[i] &= ~DRAWN;
+		
+	sdr_update_bits(s);
+	}
 	
-	qsort( s->a, p, sizeof(int), cmpfunc);
-
-	free(range);
 
+SDR* sdr_random_r (SDR *s, int p, Random *R) // fill s with p random bits (in place)
+	{
+	s->p = 0;
+	sdr_sample(s, p, R);
 	return s;
 	}
 	
+SDR* sdr_random (SDR *s, int p)
+	{
+	return sdr_random_r(s, p, random_thread());
+	}
+	
+	
 // add noise to an SDR, operating in place
-// bits > 0 : add bits (salt)
+// bits > 0 : add bits (salt), fewer bits are added where random positions are set already, at most cap - p bits
 // bits < 0 : remove bits (pepper)
 
-SDR* sdr_noise( SDR*s, int bits)
+SDR* sdr_noise_r (SDR *s, int bits, Random *R)
 	{
-	SDR* t = sdr_new(s->n); sdr_set(t,s);
-	
-	if (bits >= 0) // add bits (salt noise)
+	if (bits >= 0)
 		{
-		// add random SDR r
-		// less than the desired number of bits will be added if r overlaps with s
-		
-		SDR* r = sdr_new(s->n);
-		sdr_or(s, t, sdr_random(r, bits));
-		sdr_delete(r);
+		sdr_sample(s, bits, R);
+		return s;
 		}
 		
-	else	{
-		// remove bits
-		srand_init();
-
-		s->p += bits;
-		if (s->p < 0) s->p = 0;
-		
-		for (int k = 0; k < s->p; k++) // random selection of s->p integers from SDR t
-			{
-			int r = rand() % t->p;
-			s->a[k] = t->a[r];
-			int tmp = t->a[t->p-1]; t->a[t->p-1] = t->a[r]; t->a[r] = tmp; // swap selected value to the end
-			t->p--; // values swapped to the end won't get picked again
-			}
-
-		qsort( s->a, s->p, sizeof(int), cmpfunc);
-		}
+	// flag the positions to remove, or the positions to keep if they are fewer, then compact s in order
 	
-	sdr_delete(t);
+	unsigned int *a = (unsigned int*) s->a;
+	int remove = -bits < s->p ? -bits : s->p, keep = s->p - remove;
+	int flag = keep < remove ? keep : remove, n = 0;
+	
+	for (int f = 0; f < flag; )
+		{
+		int i = (int) (((random_next(R) >> 32) * (uint64_t) s->p) >> 32);
+		if (! (a[i] & DRAWN)) { a[i] |= DRAWN; f++; }
+		}
+		
+	for (int i = 0; i < s->p; i++)
+		if (!! (a[i] & DRAWN) == (flag == keep))
+			a[n++] = a[i] & ~DRAWN;
+			
+	s->p = n;
+	sdr_update_bits(s);
 	return s;
 	}
 	
+SDR* sdr_noise (SDR *s, int bits)
+	{
+	return sdr_noise_r(s, bits, random_thread());
+	}
+	
 	
 	
 SDR *sdr_new(int n)
+	{
+	return sdr_new_capacity(n, n);
+	}
+	
+SDR *sdr_new_capacity(int n, int cap)
 	{
 	SDR *s = malloc(sizeof(SDR));
-	s->a = malloc(n*sizeof(int));
+	s->a = malloc((cap > 0 ? cap : 1) * sizeof(int));
 	s->n = n;
 	s->p = 0;
+	s->cap = cap;
+	s->bits = 0;
 	return s;
 	}
 	
 void sdr_delete(SDR *s)
 	{
+	free(s->bits);
 	free(s->a);
 	free(s);
 	}
 	
 	
+SDR *sdr_new_dense (int n)
+	{
+	return sdr_dense(sdr_new(n));
+	}
+	
+SDR *sdr_dense (SDR *s)
+	{
+	if (! s->bits)
+		s->bits = malloc((SDR_WORDS(s) + 1) * sizeof(word));
+	sdr_update_bits(s);
+	return s;
+	}
+	
+	
+SDR *sdr_from_bits (SDR *s, const word *bits)
+	{
+	int words = SDR_WORDS(s), *a = s->a, p = 0, cap = s->cap, full = 0;
+	word tail = s->n % 64 ? (1ull << s->n % 64) - 1 : ~0ull; // ignore bits beyond n
+	
+	for (int t = 0; t < words && ! full; t++)
+		for (word m = t < words - 1 ? bits[t] : bits[t] & tail; m; m &= m - 1)
+			{
+			if (p == cap) { full = 1; break; }
+			a[p++] = 64 * t + __builtin_ctzll(m);
+			}
+			
+	s->p = p;
+	if (full || s->bits != bits)
+		sdr_update_bits(s);
+	return s;
+	}
+	
+word *sdr_to_bits (SDR *s, word *bits)
+	{
+	if (s->bits)
+		memcpy(bits, s->bits, SDR_WORDS(s) * sizeof(word));
+	else	{
+		memset(bits, 0, SDR_WORDS(s) * sizeof(word));
+		for (int i = 0; i < s->p; i++)
+			bits[s->a[i] / 64] |= 1ull << s->a[i] % 64;
+		}
+	return bits;
+	}
+
+	
+	
 	
 SDR *sdr_set( SDR *x, SDR *y) // copy y to x
 	{
-	// x and y need to have the same dimension n
-	for (int i = 0; i < y->p; i++)
+	// x and y need to have the same dimension n, x keeps the first cap positions of y
+	x->p = y->p < x->cap ? y->p : x->cap;
+	for (int i = 0; i < x->p; i++)
 		x->a[i] = y->a[i];
-	x->p = y->p;
+	sdr_update_bits(x);
 	return x;
 	}
 	
@@ -197,6 +528,7 @@ SDR *sdr_rotateright( SDR *x ) // shift x right by one bit, operating in place
 		x->a[0] = 0;
 		}
 	
+	sdr_update_bits(x);
 	return x;
 	}
 
@@ -216,346 +548,2573 @@ SDR *sdr_rotateleft( SDR *x ) // shift x left by one bit, operating in place
 		x->a[x->p - 1] = x->n - 1  ;
 		}
 	
+	sdr_update_bits(x);
 	return x;
 	}
 
 	
 	
 	
-SDR *sdr_or (SDR*res, SDR *x, SDR *y)
+// bitmap kernels for dense SDRs: res = x op y word by word (res may be 0), returning the number of set bits
+
+enum { BITS_AND, BITS_OR, BITS_XOR };
+
+static int bits_combine_64 (word *res, const word *x, const word *y, int nwords, int op)
 	{
-	// calculates the logical OR of x and y, stores the result in res
-	// x, y and res need to have the same dimension n
-	res->p = 0;
+	int count = 0;
 	
-	int i = 0, j = 0;
-	
-	while (i < x->p || j < y->p )
+	for (int t = 0; t < nwords; t++)
 		{
-		if (i == x->p) while (j < y->p)
-			res->a[ res->p++] = y->a[j++];
-				
-		else if (j == y->p) while (i < x->p)
-			res->a[ res->p++] = x->a[i++];
-		
-		else if (x->a[i] < y->a[j] )
-			res->a[ res->p++] = x->a[i++];
-			
-		else if (x->a[i] > y->a[j] )
-			res->a[ res->p++] = y->a[j++];
+		word w = op == BITS_AND ? x[t] & y[t] : op == BITS_OR ? x[t] | y[t] : x[t] ^ y[t];
+		if (res) res[t] = w;
+		count += __builtin_popcountll(w);
+		}
 		
-		else // x->a[i] == y->a[j]
-			{ res->a[ res->p++] = x->a[i]; i++; j++; }
-			
+	return count;
+	}
+
+
+#if defined(X86_DISPATCH)
+
+// SIMD popcounts look up the bit counts of the low and high nibbles of each byte, and add up the bytes of
+// each 64-bit lane with a sum of absolute differences
+
+TARGET_AVX2 static inline __m256i popcount_avx2 (__m256i v)
+	{
+	const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	
+	__m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+			_mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+	return _mm256_sad_epu8(c, _mm256_setzero_si256());
+	}
+
+TARGET_AVX2 static int bits_combine_avx2 (word *res, const word *x, const word *y, int nwords, int op)
+	{
+	__m256i sum = _mm256_setzero_si256();
+	int t = 0;
+	
+	for (; t + 4 <= nwords; t += 4)
+		{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(x + t)), b = _mm256_loadu_si256((const __m256i*)(y + t));
+		__m256i w = op == BITS_AND ? _mm256_and_si256(a, b) : op == BITS_OR ? _mm256_or_si256(a, b) : _mm256_xor_si256(a, b);
+		if (res) _mm256_storeu_si256((__m256i*)(res + t), w);
+		sum = _mm256_add_epi64(sum, popcount_avx2(w));
 		}
+		
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
 	
-	return res;
+	return (int) (_mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1))
+		+ bits_combine_64(res ? res + t : 0, x + t, y + t, nwords - t, op); // remaining words
 	}
+
+
+TARGET_AVX512 static inline __m512i popcount_avx512 (__m512i v)
+	{
+	const __m512i lookup = _mm512_broadcast_i32x4(_mm_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4));
+	const __m512i low = _mm512_set1_epi8(0x0f);
 	
+	__m512i c = _mm512_add_epi8(_mm512_shuffle_epi8(lookup, _mm512_and_si512(v, low)),
+			_mm512_shuffle_epi8(lookup, _mm512_and_si512(_mm512_srli_epi16(v, 4), low)));
+	return _mm512_sad_epu8(c, _mm512_setzero_si512());
+	}
+
+TARGET_AVX512 static int bits_combine_avx512 (word *res, const word *x, const word *y, int nwords, int op)
+	{
+	__m512i sum = _mm512_setzero_si512();
 	
-int sdr_equal( SDR*x, SDR*y) // test if x and y are identical
+	for (int t = 0; t < nwords; t += 8) // masked loads and stores for the last block
+		{
+		__mmask8 lanes = nwords - t >= 8 ? 0xFF : (__mmask8)((1u << (nwords - t)) - 1);
+		__m512i a = _mm512_maskz_loadu_epi64(lanes, x + t), b = _mm512_maskz_loadu_epi64(lanes, y + t);
+		__m512i w = op == BITS_AND ? _mm512_and_si512(a, b) : op == BITS_OR ? _mm512_or_si512(a, b) : _mm512_xor_si512(a, b);
+		if (res) _mm512_mask_storeu_epi64(res + t, lanes, w);
+		sum = _mm512_add_epi64(sum, popcount_avx512(w));
+		}
+		
+	return (int) _mm512_reduce_add_epi64(sum);
+	}
+
+#endif
+
+
+// set operations on sorted position lists: branchless merges step through both lists without data-dependent
+// branches, the SIMD overlap kernels compare a block of 8 or 16 positions of one list with each position of the
+// other, and a list much shorter than the other is looked up in it by galloping
+
+#define GALLOP_RATIO	16	// gallop when one list is at least this many times longer than the other
+#define GALLOP_RATIO_SIMD 64	// the same for the SIMD overlap kernels, which skip blocks of the longer list
+
+// first index k >= lo with a[k] >= v, found with doubling steps from lo and a branchless bisection
+
+static inline int gallop (const int *a, int lo, int n, int v)
 	{
-	int i = 0;
+	int hi = lo, step = 1;
 	
-	if ( x->p != y->p) return 0;
+	while (hi < n && a[hi] < v)
+		{ lo = hi + 1; hi += step; step *= 2; }
+	if (hi > n) hi = n;
+	if (lo == hi) return lo;
 	
-	for (i = 0; i < x->p; i++)
-		if (x->a[i] != y->a[i]) return 0;
+	const int *base = a + lo; // a[hi] >= v or hi == n, the result is in [lo, hi]
+	for (int len = hi - lo; len > 1; len -= len / 2)
+		base = base[len / 2] < v ? base + len / 2 : base;
 		
-	return 1; // same
+	return base - a + (*base < v);
 	}
 	
 	
-int sdr_distance( SDR*x, SDR*y) // Hamming distance
+static int overlap_gallop (const int *a, int na, const int *b, int nb) // a is the shorter list
 	{
-	int i = 0, j = 0, h = x->p + y->p;
+	int count = 0;
 	
-	while (i < x->p && j < y->p )
+	for (int i = 0, j = 0; i < na && j < nb; i++)
 		{
-		if (x->a[i] == y->a[j])
-			{ h -= 2; i++; j++; }
-		else if (x->a[i] < y->a[j]) ++i;
-		else ++j;
+		j = gallop(b, j, nb, a[i]);
+		count += j < nb && b[j] == a[i];
 		}
-	
-	return h;
+	return count;
 	}
 	
 	
-int sdr_overlap( SDR*x, SDR*y) // number of common bits
+// number of common positions
+
+static int overlap_64 (const int *a, int na, const int *b, int nb)
 	{
-	int i = 0, j = 0, overlap = 0;
+	int i = 0, j = 0, count = 0;
 	
-	while (i < x->p && j < y->p )
+	while (i < na && j < nb)
 		{
-		if (x->a[i] == y->a[j])
-			{ ++overlap; i++; j++; }
-		else if (x->a[i] < y->a[j]) ++i;
-		else ++j;
+		int u = a[i], v = b[j];
+		count += u == v;
+		i += u <= v;
+		j += v <= u;
 		}
-	
-	return overlap;
+	return count;
 	}
-	
-	
-// print SDR with positions from 1 to N (representation used by command line tools)
-void sdr_print(SDR *s)
+
+
+#if defined(X86_DISPATCH)
+
+// each position of a block of a is compared with a block of b, padded with -1 beyond the end of b
+// the block with the smaller last position is done, both are done if their last positions are equal
+
+TARGET_AVX2 static int overlap_avx2 (const int *a, int na, const int *b, int nb)
 	{
-	for (int r = 0; r < s->p; r++)
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int i = 0, j = 0, count = 0;
+	
+	while (i < na && j < nb)
 		{
-		printf("%d", s->a[r] + 1);  // adding 1 to the internal representation
-		if (r < s->p -1) printf(" ");
+		int ka = na - i < 8 ? na - i : 8, kb = nb - j < 8 ? nb - j : 8;
+		int la = a[i + ka - 1], lb = b[j + kb - 1];
+		
+		if (lb < a[i]) { j += kb; continue; } // skip blocks without common positions
+		if (la < b[j]) { i += ka; continue; }
+		
+		__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(kb), lane);
+		__m256i vb = _mm256_or_si256(_mm256_maskload_epi32(b + j, valid), _mm256_xor_si256(valid, _mm256_set1_epi32(-1)));
+		__m256i match = _mm256_setzero_si256();
+		
+		for (int k = 0; k < ka; k++)
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi32(_mm256_set1_epi32(a[i + k]), vb));
+		count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(match)));
+		
+		i += la <= lb ? ka : 0;
+		j += lb <= la ? kb : 0;
 		}
-	printf("\n"); fflush(stdout);
+	return count;
 	}
 	
-// print SDR with positions from 0 to N-1 (the internal representation)
-void sdr_print0(SDR *s)
+	
+TARGET_AVX512 static int overlap_avx512 (const int *a, int na, const int *b, int nb)
 	{
-	for (int r = 0; r < s->p; r++)
+	int i = 0, j = 0, count = 0;
+	
+	while (i < na && j < nb)
 		{
-		printf("%d", s->a[r] );
-		if (r < s->p -1) printf(" ");
+		int ka = na - i < 16 ? na - i : 16, kb = nb - j < 16 ? nb - j : 16;
+		int la = a[i + ka - 1], lb = b[j + kb - 1];
+		
+		if (lb < a[i]) { j += kb; continue; } // skip blocks without common positions
+		if (la < b[j]) { i += ka; continue; }
+		
+		__m512i vb = _mm512_mask_loadu_epi32(_mm512_set1_epi32(-1), (__mmask16)((1u << kb) - 1), b + j);
+		__mmask16 match = 0;
+		
+		for (int k = 0; k < ka; k++)
+			match |= _mm512_cmpeq_epi32_mask(_mm512_set1_epi32(a[i + k]), vb);
+		count += __builtin_popcount(match);
+		
+		i += la <= lb ? ka : 0;
+		j += lb <= la ? kb : 0;
 		}
-	printf("\n"); fflush(stdout);
+	return count;
 	}
-	
 
-#define bit_set(a,i)     a[(i)/8]  |=  (1u << (i)%8)
-#define bit_clear(a,i)   a[(i)/8]  &= ~(1u << (i)%8)
-#define bit_test(a,i)    a[(i)/8]  &   (1u << (i)%8)  ? 1 : 0
-	
-	
-// ---------- Dyadic Memory -- stores hetero-associations x->y ----------
+#endif
 
 
-DyadicMemory *dyadicmemory_new(int nx, int ny, int p)
+static int overlap (SDR *x, SDR *y)
 	{
-	DyadicMemory *D = malloc(sizeof(DyadicMemory));
-	
-	D->nx 		= nx;	// dimension of x
-	D->ny 		= ny;	// dimension of y
-	D->p  		= p; 	// sparsity target for y
-	
-	// allocate and initialize nx(nx-1)/2 bit-pair addresses for x
-	// the storage arrays for each address will be allocated and initialized as needed
-
-	D->C = (byte**) calloc( (1 + D->nx*(D->nx-1)/2), sizeof(byte*));
+	SDR *s = x->p <= y->p ? x : y, *l = x->p <= y->p ? y : x; // shorter and longer list
 	
-	return D;
+	if (l->p >= (K.level == SIMD_PORTABLE ? GALLOP_RATIO : GALLOP_RATIO_SIMD) * s->p)
+		return overlap_gallop(s->a, s->p, l->a, l->p);
+	return K.overlap(s->a, s->p, l->a, l->p);
 	}
 	
 	
 	
-void dyadicmemory_write (DyadicMemory *D, SDR *x, SDR *y)
+// union and intersection, res keeps the first cap positions
+
+KERNEL SDR *sdr_or_kernel (SDR*res, SDR *x, SDR *y)
 	{
-	if (y->p == 0) return;
-					
-	for (int j = 1; j < x->p; j++ ) for (int i = 0; i < j; i++ )
+	const int *a = x->a, *b = y->a;
+	int *r = res->a, na = x->p, nb = y->p, cap = res->cap, i = 0, j = 0, k = 0;
+	
+	while (i < na && j < nb && k < cap)
 		{
-		int addr = x->a[i] + x->a[j]*(x->a[j]-1) / 2;
+		int u = a[i], v = b[j];
+		r[k++] = u < v ? u : v;
+		i += u <= v;
+		j += v <= u;
+		}
 		
-		// lazy allocation of array for y
-		if (! D->C[addr])
-			D->C[addr] = (byte*) calloc( (D->ny+7)/8, 1);
+	while (i < na && k < cap) r[k++] = a[i++];
+	while (j < nb && k < cap) r[k++] = b[j++];
+	
+	res->p = k;
+	return res;
+	}
+	
+KERNEL_VARIANTS (SDR*, sdr_or_kernel, (SDR *res, SDR *x, SDR *y), return sdr_or_kernel(res, x, y))
 
-		byte *Y = D->C[addr];
 
-		for (int k = 0; k < y->p; k++)
-			bit_set (Y, (unsigned int)y->a[k]);
-										
+// union of a short list a and a long list b, the runs of b between positions of a are copied as blocks
+
+static void or_gallop (SDR *res, SDR *x, SDR *y)
+	{
+	const int *a = x->a, *b = y->a;
+	int *r = res->a, na = x->p, nb = y->p, cap = res->cap, j = 0, k = 0;
+	
+	for (int i = 0; i <= na && k < cap; i++)
+		{
+		int next = i < na ? gallop(b, j, nb, a[i]) : nb, run = next - j < cap - k ? next - j : cap - k;
+		
+		memcpy(r + k, b + j, run * sizeof(int));
+		k += run;
+		j = next;
+		
+		if (i < na && k < cap)
+			{
+			r[k++] = a[i];
+			j += j < nb && b[j] == a[i];
+			}
 		}
+	res->p = k;
 	}
 	
-
-static SDR* dm_query (DyadicMemory *D, SDR *x, SDR *y, int p)
+SDR *sdr_or (SDR*res, SDR *x, SDR *y)
 	{
-	int* response = (int*)calloc(D->ny, sizeof(int));
-
-	for (int j = 1; j < x->p; j++ ) for ( int i = 0; i < j; i++ )
+	if (res->bits && x->bits && y->bits)
 		{
-		byte *Y = D->C[x->a[i] + x->a[j]*(x->a[j]-1) / 2];
-
-		if (Y) for (unsigned int k = 0; k < D->ny; k++)
-			response[k] += bit_test(Y, k);
-
+		K.bits_combine(res->bits, x->bits, y->bits, SDR_WORDS(res), BITS_OR);
+		return sdr_from_bits(res, res->bits);
 		}
-						
-	return binarize(y, response, p);
+	
+	if (y->p >= GALLOP_RATIO * x->p)
+		or_gallop(res, x, y);
+	else if (x->p >= GALLOP_RATIO * y->p)
+		or_gallop(res, y, x);
+	else	K.sdr_or(res, x, y);
+	
+	sdr_update_bits(res);
+	return res;
 	}
 	
-
-SDR* dyadicmemory_read (DyadicMemory *D, SDR *x, SDR *y)
+	
+KERNEL SDR *sdr_and_kernel (SDR*res, SDR *x, SDR *y)
 	{
-	return dm_query (D, x, y, D->p);	
+	const int *a = x->a, *b = y->a;
+	int *r = res->a, na = x->p, nb = y->p, cap = res->cap, i = 0, j = 0, k = 0;
+	
+	if (nb >= GALLOP_RATIO * na || na >= GALLOP_RATIO * nb) // look up the shorter list in the longer
+		{
+		if (na > nb) { const int *t = a; a = b; b = t; int n = na; na = nb; nb = n; }
+		
+		for (; i < na && j < nb && k < cap; i++)
+			{
+			j = gallop(b, j, nb, a[i]);
+			if (j < nb && b[j] == a[i]) r[k++] = a[i];
+			}
+		}
+		
+	else while (i < na && j < nb && k < cap)
+		{
+		int u = a[i], v = b[j];
+		r[k] = u;
+		k += u == v;
+		i += u <= v;
+		j += v <= u;
+		}
+	
+	res->p = k;
+	return res;
 	}
-
-SDR* dyadicmemory_read_p (DyadicMemory *D, SDR *x, SDR *y, int p)
+	
+KERNEL_VARIANTS (SDR*, sdr_and_kernel, (SDR *res, SDR *x, SDR *y), return sdr_and_kernel(res, x, y))
+	
+SDR *sdr_and (SDR*res, SDR *x, SDR *y)
 	{
-	return dm_query (D, x, y, p);	
+	if (res->bits && x->bits && y->bits)
+		{
+		K.bits_combine(res->bits, x->bits, y->bits, SDR_WORDS(res), BITS_AND);
+		return sdr_from_bits(res, res->bits);
+		}
+	
+	K.sdr_and(res, x, y);
+	sdr_update_bits(res);
+	return res;
 	}
-
-
-
-// ---------- Triadic Memory -- stores triple associations (x,y,z}  ----------
-
-
-TriadicMemory *triadicmemory_new(int n, int p)
+	
+	
+int sdr_equal( SDR*x, SDR*y) // test if x and y are identical
 	{
-	return triadicmemory_new3 (n, p, n, p, n, p);
+	return x->p == y->p && ! memcmp(x->a, y->a, x->p * sizeof(int));
 	}
-
-TriadicMemory *triadicmemory_new3 (int nx, int px, int ny, int py, int nz, int pz)
+	
+int sdr_distance( SDR*x, SDR*y) // Hamming distance
+	{
+	if (x->bits && y->bits)
+		return K.bits_combine(0, x->bits, y->bits, SDR_WORDS(x), BITS_XOR);
+	return x->p + y->p - 2 * overlap(x, y);
+	}
+	
+int sdr_overlap( SDR*x, SDR*y) // number of common bits
 	{
-	srand_init();
+	if (x->bits && y->bits)
+		return K.bits_combine(0, x->bits, y->bits, SDR_WORDS(x), BITS_AND);
+	return overlap(x, y);
+	}
 	
-	TriadicMemory *T = malloc(sizeof(TriadicMemory));
-		
-	T->nx = nx;		// vector dimensions of x, y, and z
-	T->ny = ny;
-	T->nz = nz;
-	T->px = px;		// target sparse populations of x, y, and z
-	T->py = py;
-	T->pz = pz;
-
-	T->forgetting = 0; 	// random forgetting is an experimental feature, disabled by default
 	
-	// allocate and initialize the entire storage cube, 1 bit per location
-	// limitation: malloc may fail for large n, use virtual memory instead in this case
-		
-	T->C = (byte*) calloc( (T->nx * T->ny * T->nz + 7) / 8, 1);
+int bits_overlap (const word *x, const word *y, int n)
+	{
+	return K.bits_combine(0, x, y, (n + 63) / 64, BITS_AND);
+	}
 	
-	return T;
+int bits_distance (const word *x, const word *y, int n)
+	{
+	return K.bits_combine(0, x, y, (n + 63) / 64, BITS_XOR);
 	}
 	
 	
-void triadicmemory_write (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+// print SDR with positions from 1 to N (representation used by command line tools)
+void sdr_print(SDR *s)
 	{
-	int Qx = T->ny * T->nz, Qy = T->nz;
-
-	// original triadic memory write algorithm, modified to use 1-bit address locations
-
-	for (int i = 0; i < x->p; i++) for (int j = 0; j < y->p; j++) for (int k = 0; k < z->p; k++)
+	for (int r = 0; r < s->p; r++)
 		{
-		unsigned int b = Qx * x->a[i] + Qy * y->a[j] + z->a[k];
-		bit_set(T->C, b);
+		printf("%d", s->a[r] + 1);  // adding 1 to the internal representation
+		if (r < s->p -1) printf(" ");
 		}
-
-	
-	// the following is not part of the original triadic memory algorithm and disabled by default
-	// random forgetting, realized by decrementing the same number of memory locations (but not below zero)
-	// this has no measurable effect for an almost empty memory
+	printf("\n"); fflush(stdout);
+	}
 	
-	if (T->forgetting)
+// print SDR with positions from 0 to N-1 (the internal representation)
+void sdr_print0(SDR *s)
+	{
+	for (int r = 0; r < s->p; r++)
 		{
-		int memsize = T->nx * T->ny * T->nz;
-		for (int i = 0; i < x->p * y->p * z->p; i++)
-			{
-			unsigned int b = rand() % memsize;
-			bit_clear(T->C, b);
-			}
+		printf("%d", s->a[r] );
+		if (r < s->p -1) printf(" ");
 		}
+	printf("\n"); fflush(stdout);
 	}
 	
-		
 
-// triadic memory read algorithm, modified for 1-bit storage locations
 
-// there is a query function for x, y, and z, respectively
-// weights are collected into an response vector
-// the function binarize converts the response vector to a binary SDR with the specified target population
-// note that the result can have a population less or greater than specified
+// ---------- SDR pool ----------
 
 
-SDR* triadicmemory_read_x (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+SDRPool *sdrpool_new (int n, size_t count, int cap)
 	{
-	int* response = (int*)calloc(T->nx, sizeof(int));
-	int Qx = T->ny * T->nz, Qy = T->nz;
-
-	for (int j = 0; j < y->p; j++) for (int k = 0; k < z->p; k++)
+	SDRPool *P = malloc(sizeof(SDRPool));
+	
+	P->n = n;
+	P->count = P->maxcount = count;
+	P->size = P->maxsize = count * cap;
+	P->sdr = malloc((count ? count : 1) * sizeof(SDR));
+	P->a = malloc((P->size ? P->size : 1) * sizeof(int));
+	
+	for (size_t i = 0; i < count; i++)
+		P->sdr[i] = (SDR) { P->a + i * cap, n, 0, cap, 0 };
+		
+	return P;
+	}
+	
+void sdrpool_delete (SDRPool *P)
+	{
+	free(P->a);
+	free(P->sdr);
+	free(P);
+	}
+	
+void sdrpool_clear (SDRPool *P)
+	{
+	P->count = P->size = 0;
+	}
+	
+	
+SDR *sdrpool_add (SDRPool *P, SDR *s, int cap)
+	{
+	if (cap < s->p) cap = s->p;
+	
+	if (P->count == P->maxcount)
 		{
-		unsigned int addr = Qy * y->a[j] + z->a[k];
+		P->maxcount = P->maxcount ? 2 * P->maxcount : 1024;
+		P->sdr = realloc(P->sdr, P->maxcount * sizeof(SDR));
+		}
 		
-		for (int i = 0; i < T->nx; i++)
-			{
-			unsigned int b = addr + Qx*i;
-			response[i] += bit_test(T->C, b);
-			}
+	if (P->size + cap > P->maxsize)
+		{
+		uintptr_t a = (uintptr_t) P->a;
+		
+		while (P->size + cap > P->maxsize)
+			P->maxsize = P->maxsize ? 2 * P->maxsize : 16384;
+		P->a = realloc(P->a, P->maxsize * sizeof(int));
+		
+		for (size_t i = 0; i < P->count; i++) // move the members along with the positions
+			P->sdr[i].a = P->a + ((uintptr_t) P->sdr[i].a - a) / sizeof(int);
 		}
-
-	return binarize(x, response, T->px);
+		
+	SDR *m = P->sdr + P->count++;
+	
+	*m = (SDR) { P->a + P->size, P->n, 0, cap, 0 };
+	P->size += cap;
+	
+	return sdr_set(m, s);
 	}
 
 
-SDR* triadicmemory_read_y (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+
+// bit operations on arrays of bytes or 64-bit words
+
+#define BITS(a)          (8 * sizeof *(a))
+
+#define bit_test(a,i)    a[(i)/BITS(a)]  &   (1ull << (i)%BITS(a))  ? 1 : 0
+
+
+// storage cells of TM_CELLBITS bits (see triadicmemory.h): a row of cells is stored as TM_CELLBITS bit planes,
+// plane b holding bit b of every counter, with consecutive planes `plane` words apart
+// counters are incremented and decremented with a ripple carry through the planes, saturating at TM_CELLMAX and 0
+// in concurrent mode (atomic), each plane is flipped with an atomic xor whose previous value decides about the carry,
+// and a carry out of the top plane (from counters saturating concurrently) is undone
+
+static inline int cell_get (word *row, size_t plane, unsigned int i)
+	{
+	int v = 0;
+	for (int b = 0; b < TM_CELLBITS; b++)
+		v |= (int) (row[b*plane + i/64] >> (i%64) & 1) << b;
+	return v;
+	}
+	
+static inline void cell_update (word *row, size_t plane, unsigned int i, int atomic, int inc)
 	{
-	int* response = (int*)calloc(T->ny, sizeof(int));
-	int Qx = T->ny * T->nz, Qy = T->nz;
+	word m = 1ull << (i%64);
+	row += i/64;
+	
+#if TM_CELLBITS == 1
+	if (inc)
+		{ if (atomic) __atomic_fetch_or (row, m, __ATOMIC_RELAXED); else *row |= m; }
+	else
+		{ if (atomic) __atomic_fetch_and (row, ~m, __ATOMIC_RELAXED); else *row &= ~m; }
+	(void) plane;
+#else
+	if (cell_get(row, plane, i%64) == (inc ? TM_CELLMAX : 0))
+		return;
 		
-	for ( int i = 0; i < x->p; i++) for ( int k = 0; k < z->p; k++)
+	for (int b = 0; b < TM_CELLBITS; b++)
 		{
-		unsigned int addr = Qx * x->a[i] + z->a[k];
-		
-		for ( int j = 0; j < T->ny; j++)
-			{
-			unsigned int b = addr + Qy*j;
-			response[j] += bit_test(T->C, b );
-			}
+		word old = atomic ? __atomic_fetch_xor (row + b*plane, m, __ATOMIC_RELAXED) : (row[b*plane] ^= m) ^ m;
+		if ((old & m) == (inc ? 0 : m)) return; // no carry (a 0 bit was incremented) or borrow (a 1 bit was decremented)
 		}
+		
+	for (int b = 0; b < TM_CELLBITS; b++) // wrapped around: saturate
+		if (inc)
+			{ if (atomic) __atomic_fetch_or (row + b*plane, m, __ATOMIC_RELAXED); else row[b*plane] |= m; }
+		else
+			{ if (atomic) __atomic_fetch_and (row + b*plane, ~m, __ATOMIC_RELAXED); else row[b*plane] &= ~m; }
+#endif
+	}
+	
+#define cell_inc(row,plane,i,atomic)	cell_update (row, plane, i, atomic, 1)
+#define cell_dec(row,plane,i,atomic)	cell_update (row, plane, i, atomic, 0)
+	
+	
+// ---------- Dyadic Memory -- stores hetero-associations x->y ----------
+
+
+DyadicMemory *dyadicmemory_new(int nx, int ny, int p)
+	{
+	DyadicMemory *D = malloc(sizeof(DyadicMemory));
+	
+	D->nx 		= nx;	// dimension of x
+	D->ny 		= ny;	// dimension of y
+	D->p  		= p; 	// sparsity target for y
+	
+	// the nx(nx-1)/2 bit-pair addresses for x are organized by the larger bit j of a pair
+	// the hash tables for each j and the storage arrays for each address will be allocated as needed
 
-	return binarize(y, response, T->py);
+	D->C = (DyadicLeaf*) calloc( nx, sizeof(DyadicLeaf));
+	
+	D->slab = 0;
+	D->slabfree = 0;
+	D->rowbytes = (ny + 63) / 64 * 8;
+	D->listmax = D->rowbytes * TM_CELLBITS / sizeof(int) / 2; // a full list takes half the memory of a bitmap
+	D->freelists = 0;
+	
+	return D;
 	}
+	
 
+// storage rows are carved from zero-initialized slabs, instead of one calloc each
+// bitmaps are never freed, lists are kept for reuse when their rows become bitmaps
 
+#define SLAB_BYTES	(1 << 20)
 
-SDR* triadicmemory_read_z (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+static void* dm_alloc (DyadicMemory *D, size_t bytes)
 	{
-	int* response = (int*)calloc(T->nz, sizeof(int));
-	int Qx = T->ny * T->nz, Qy = T->nz;
+	bytes = (bytes + 7) / 8 * 8;
 	
-	for (int i = 0; i < x->p; i++) for (int j = 0; j < y->p; j++)
+	if (bytes > D->slabfree)
 		{
-		unsigned int addr = Qx * x->a[i] + Qy * y->a[j];
+		D->slabfree = bytes > SLAB_BYTES ? bytes : SLAB_BYTES; // remainder of the previous slab is left unused
+		D->slab = (byte*) calloc(D->slabfree, 1);
+		}
+		
+	void *a = D->slab;
+	D->slab += bytes;
+	D->slabfree -= bytes;
+	return a;
+	}
+	
+static int* dm_list (DyadicMemory *D)
+	{
+	void **list = (void**) D->freelists;
+	
+	if (! list)
+		return (int*) dm_alloc(D, D->listmax * sizeof(int));
+		
+	D->freelists = *list;
+	return (int*) list;
+	}
+	
+	
+// rows holding few positions are sorted lists, which are promoted to bitmaps when they exceed listmax entries
+// a list holds each position as many times as its counter value, at most TM_CELLMAX times
 
-		for (int k = 0; k < T->nz; k++)
+static void dm_store (DyadicMemory *D, DyadicSlot *s, SDR *y)
+	{
+	size_t plane = D->rowbytes / 8;
+	
+	if (s->n >= 0)
+		{
+		int *list = (int*) s->row, n = s->n, u = n;
+		
+		for (int a = 0, b = 0; b < y->p; b++) // u: list size after adding y
+			{
+			int r = 0;
+			while (a < n && list[a] < y->a[b]) a++;
+			while (a < n && list[a] == y->a[b]) { a++; r++; }
+			if (r < TM_CELLMAX) u++;
+			}
+			
+		if (u <= D->listmax) // merge from the back, in place
 			{
-			unsigned int b = addr + k;
-			response[k] += bit_test(T->C, b);
+			for (int a = n - 1, b = y->p - 1, k = u - 1; b >= 0; b--)
+				{
+				int r = 0;
+				while (a >= 0 && list[a] > y->a[b]) list[k--] = list[a--];
+				while (a >= 0 && list[a] == y->a[b]) { list[k--] = list[a--]; r++; }
+				if (r < TM_CELLMAX) list[k--] = y->a[b];
+				}
+			s->n = u;
+			return;
 			}
+			
+		word *Y = (word*) dm_alloc(D, D->rowbytes * TM_CELLBITS);
+		for (int k = 0; k < n; k++)
+			cell_inc (Y, plane, list[k], 0);
+			
+		*(void**) list = D->freelists;
+		D->freelists = list;
+		s->row = Y;
+		s->n = -1;
 		}
 		
-	return binarize(z, response, T->pz);
+	word *Y = (word*) s->row;
+	
+	for (int k = 0; k < y->p; k++)
+		cell_inc (Y, plane, y->a[k], 0);
 	}
 	
+	
+// removes one occurrence of each position of y from a list, or decrements the counters of a bitmap
+// rows are never demoted or freed
 
+#if TM_CELLBITS > 1
+static void dm_remove (DyadicMemory *D, DyadicSlot *s, SDR *y)
+	{
+	if (s->n < 0)
+		{
+		for (int k = 0; k < y->p; k++)
+			cell_dec ((word*) s->row, D->rowbytes / 8, y->a[k], 0);
+		return;
+		}
+		
+	int *list = (int*) s->row, n = 0;
+	
+	for (int a = 0, b = 0; a < s->n; a++)
+		{
+		while (b < y->p && y->a[b] < list[a]) b++;
+		if (b < y->p && y->a[b] == list[a]) b++; // drop the first occurrence
+		else list[n++] = list[a];
+		}
+		
+	s->n = n;
+	}
+#endif
+	
+	
+// slot of the pair (i,j) in leaf L = C[j]: either the slot holding i, or the empty slot where i belongs
+// Fibonacci hashing: the top bits of the product depend on all bits of i, unlike the bottom bits
 
-// ---------- Command Line Functions ----------
-
+static inline DyadicSlot* dm_find (DyadicLeaf *L, int i)
+	{
+	uint32_t mask = L->size - 1, h = ((uint32_t) i * 2654435761u) >> L->shift;
+	
+	while (L->slot[h].row && L->slot[h].i != i)
+		h = (h + 1) & mask;
+		
+	return L->slot + h;
+	}
+	
+	
+// doubles the size of a hash table, keeping it at most half full
 
+static void dm_grow (DyadicLeaf *L)
+	{
+	DyadicLeaf old = *L;
+	
+	L->size = old.size ? 2 * old.size : 8;
+	L->shift = old.size ? old.shift - 1 : 29;
+	L->slot = (DyadicSlot*) calloc( L->size, sizeof(DyadicSlot));
+	
+	for (int h = 0; h < old.size; h++)
+		if (old.slot[h].row)
+			*dm_find(L, old.slot[h].i) = old.slot[h];
+			
+	free(old.slot);
+	}
+	
+	
+// slot of the bit pair i < j of x, 0 if nothing was stored there
 
-char* sdr_parse (char *buf, SDR *s)
+static inline DyadicSlot* dm_slot (DyadicMemory *D, int i, int j)
 	{
-	int *i;
-	s->p = 0;
+	DyadicLeaf *L = D->C + j;
+	DyadicSlot *s = L->size ? dm_find(L, i) : 0;
+	return s && s->row ? s : 0;
+	}
 	
-	while ( *buf  && *buf != SEPARATOR )
+	
+void dyadicmemory_write (DyadicMemory *D, SDR *x, SDR *y)
+	{
+	if (y->p == 0) return;
+					
+	for (int j = 1; j < x->p; j++ ) for (int i = 0; i < j; i++ )
 		{
-		while (isspace(*buf)) buf++;
-		if (! isdigit(*buf)) break;
+		DyadicLeaf *L = D->C + x->a[j];
 		
-		i = s->a + s->p;
-		sscanf( buf, "%d", i);
+		if (2 * (L->n + 1) > L->size)
+			dm_grow(L);
 		
-		if ( (*i)-- > s->n || *i < 0 ) // subtracting 1 to convert to C convention
+		DyadicSlot *s = dm_find(L, x->a[i]);
+		
+		// lazy allocation of array for y, starting as a list if y fits
+		if (! s->row)
 			{
-			printf("position out of range: %s\n", buf);
-			exit(2);
+			s->i = x->a[i];
+			s->n = y->p <= D->listmax ? 0 : -1;
+			s->row = s->n ? dm_alloc(D, D->rowbytes * TM_CELLBITS) : dm_list(D);
+			L->n ++;
 			}
-		s->p ++;
-		
-		while (isdigit(*buf)) buf++;
-		while (isspace(*buf)) buf++;
+
+		dm_store (D, s, y);
 		}
-		
-	return buf;
+	}
+	
+	
+void dyadicmemory_delete (DyadicMemory *D, SDR *x, SDR *y)
+	{
+#if TM_CELLBITS == 1
+	(void) D; (void) x; (void) y; // a 1-bit cell may also hold the bit of another association
+#else
+	for (int j = 1; j < x->p; j++ ) for (int i = 0; i < j; i++ )
+		{
+		DyadicSlot *s = dm_slot(D, x->a[i], x->a[j]);
+		if (s)
+			dm_remove (D, s, y);
+		}
+#endif
+	}
+	
+
+// bitmap rows are summed up by the row accumulation kernels (see below), list rows are added afterwards
+
+static SDR* dm_query (DyadicMemory *D, SDR *x, SDR *y, int p, Workspace *W)
+	{
+	int* response = workspace_response(W, D->rowbytes * 8);
+	word **rows = workspace_rows(W, x->p * (x->p - 1) / 2);
+	int nrows = 0;
+	
+	for (int j = 1; j < x->p; j++ ) for ( int i = 0; i < j; i++ )
+		{
+		DyadicSlot *s = dm_slot(D, x->a[i], x->a[j]);
+		if (s && s->n < 0)
+			rows[nrows++] = (word*) s->row;
+		}
+		
+	K.accumulate_rows(rows, nrows, D->rowbytes / 8, 0, D->rowbytes / 8, response);
+	
+	for (int j = 1; j < x->p; j++ ) for ( int i = 0; i < j; i++ )
+		{
+		DyadicSlot *s = dm_slot(D, x->a[i], x->a[j]);
+		if (s && s->n > 0)
+			{
+			int *list = (int*) s->row;
+			for (int k = 0; k < s->n; k++)
+				response[list[k]] ++;
+			}
+		}
+						
+	return binarize(y, response, p, W);
+	}
+	
+
+SDR* dyadicmemory_read (DyadicMemory *D, SDR *x, SDR *y)
+	{
+	return dm_query (D, x, y, D->p, default_workspace());	
+	}
+
+SDR* dyadicmemory_read_p (DyadicMemory *D, SDR *x, SDR *y, int p)
+	{
+	return dm_query (D, x, y, p, default_workspace());	
+	}
+
+SDR* dyadicmemory_read_ex (DyadicMemory *D, SDR *x, SDR *y, Workspace *W)
+	{
+	return dm_query (D, x, y, D->p, W);	
+	}
+
+SDR* dyadicmemory_read_p_ex (DyadicMemory *D, SDR *x, SDR *y, int p, Workspace *W)
+	{
+	return dm_query (D, x, y, p, W);	
+	}
+
+
+
+// ---------- Row accumulation kernels ----------
+
+// The read functions sum up a number of storage rows bit by bit. A row is a contiguous
+// sequence of 64-bit words, and the kernels below add whole words at a time into
+// vertical bit-sliced counters: plane b holds bit b of the count for each of the 64 positions
+// of a word. Only at the end are the counters expanded into the integer response vector.
+// The kernels process words first to last-1 of each row and set the corresponding
+// response entries 64*first to 64*last-1.
+// With counters of TM_CELLBITS > 1 bits, the bit planes of a row are `plane` words apart,
+// and the words of counter bit c are added in starting at plane c of the vertical counters.
+
+#define MAXPLANES 32
+
+
+static int counter_planes (int nrows) // number of bit planes needed to add up nrows rows of cells
+	{
+	unsigned int max = (unsigned int) nrows * TM_CELLMAX;
+	int b = 1;
+	while (b < MAXPLANES && (1u << b) <= max) b++;
+	return b;
+	}
+
+
+// portable 64-bit kernel
+
+static void accumulate_rows_64 (word **rows, int nrows, size_t plane, int first, int last, int *response)
+	{
+	int planes = counter_planes(nrows);
+	
+	for (int t = first; t < last; t++)
+		{
+		word c[MAXPLANES] = {0};
+		
+		for (int r = 0; r < nrows; r++) for (int p = 0; p < TM_CELLBITS; p++)
+			{
+			word carry = rows[r][p*plane + t];
+			for (int b = p; carry; b++) // ripple-carry add, stops as soon as no carry is left
+				{
+				word tmp = c[b] & carry;
+				c[b] ^= carry;
+				carry = tmp;
+				}
+			}
+		
+		int *resp = response + 64*t;
+		for (int i = 0; i < 64; i++) resp[i] = 0;
+		
+		for (int b = 0; b < planes; b++)
+			for (word m = c[b]; m; m &= m - 1)
+				resp[__builtin_ctzll(m)] += 1 << b;
+		}
+	}
+
+
+#if defined(X86_DISPATCH)
+
+// AVX2 kernel, four words per step
+
+TARGET_AVX2 static void accumulate_rows_avx2 (word **rows, int nrows, size_t plane, int first, int last, int *response)
+	{
+	int planes = counter_planes(nrows), t = first;
+	
+	const __m256i sel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	
+	for (; t + 4 <= last; t += 4)
+		{
+		__m256i c[MAXPLANES];
+		for (int b = 0; b < planes; b++) c[b] = _mm256_setzero_si256();
+		
+		for (int r = 0; r < nrows; r++) for (int p = 0; p < TM_CELLBITS; p++)
+			{
+			__m256i carry = _mm256_loadu_si256((__m256i*)(rows[r] + p*plane + t));
+			for (int b = p; b < planes && !_mm256_testz_si256(carry, carry); b++)
+				{
+				__m256i tmp = _mm256_and_si256(c[b], carry);
+				c[b] = _mm256_xor_si256(c[b], carry);
+				carry = tmp;
+				}
+			}
+		
+		// expand 8 bits at a time into 8 counters
+		
+		uint8_t planebytes[MAXPLANES][32];
+		for (int b = 0; b < planes; b++)
+			_mm256_storeu_si256((__m256i*)planebytes[b], c[b]);
+		
+		for (int g = 0; g < 32; g++)
+			{
+			__m256i acc = _mm256_setzero_si256();
+			for (int b = 0; b < planes; b++)
+				{
+				__m256i m = _mm256_and_si256(_mm256_set1_epi32(planebytes[b][g]), sel);
+				m = _mm256_cmpeq_epi32(m, sel);
+				acc = _mm256_or_si256(acc, _mm256_and_si256(m, _mm256_set1_epi32(1 << b)));
+				}
+			_mm256_storeu_si256((__m256i*)(response + 64*t + 8*g), acc);
+			}
+		}
+	
+	if (t < last) // remaining words
+		accumulate_rows_64 (rows, nrows, plane, t, last, response);
+	}
+
+
+
+// AVX-512 kernel, eight words per step, masked loads for the last block
+
+TARGET_AVX512 static void accumulate_rows_avx512 (word **rows, int nrows, size_t plane, int first, int last, int *response)
+	{
+	int planes = counter_planes(nrows);
+	
+	for (int t = first; t < last; t += 8)
+		{
+		__mmask8 lanes = last - t >= 8 ? 0xFF : (__mmask8)((1u << (last - t)) - 1);
+		
+		__m512i c[MAXPLANES];
+		for (int b = 0; b < planes; b++) c[b] = _mm512_setzero_si512();
+		
+		for (int r = 0; r < nrows; r++) for (int p = 0; p < TM_CELLBITS; p++)
+			{
+			__m512i carry = _mm512_maskz_loadu_epi64(lanes, rows[r] + p*plane + t);
+			for (int b = p; b < planes && _mm512_test_epi64_mask(carry, carry); b++)
+				{
+				__m512i tmp = _mm512_and_si512(c[b], carry);
+				c[b] = _mm512_xor_si512(c[b], carry);
+				carry = tmp;
+				}
+			}
+		
+		// expand 16 bits at a time into 16 counters
+		
+		uint16_t planebits[MAXPLANES][32];
+		for (int b = 0; b < planes; b++)
+			_mm512_storeu_si512(planebits[b], c[b]);
+		
+		int groups = 4 * (last - t < 8 ? last - t : 8);
+		for (int g = 0; g < groups; g++)
+			{
+			__m512i acc = _mm512_setzero_si512();
+			for (int b = 0; b < planes; b++)
+				acc = _mm512_mask_or_epi32(acc, planebits[b][g], acc, _mm512_set1_epi32(1 << b));
+			_mm512_storeu_si512(response + 64*t + 16*g, acc);
+			}
+		}
+	}
+
+#endif
+
+
+// add up single cells at a fixed stride, used for reading x or y from the z-major cube
+// (response[i] += cell at bit position addr + i*stride for i < n, with bit planes `plane` bits apart)
+
+KERNEL void accumulate_strided (word *C, size_t addr, size_t stride, size_t plane, int n, int *response)
+	{
+	for (int i = 0; i < n; i++)
+		{
+		size_t b = addr + stride*i;
+		for (int p = 0; p < TM_CELLBITS; p++, b += plane)
+			response[i] += (bit_test(C, b)) << p;
+		}
+	}
+	
+KERNEL_VARIANTS (void, accumulate_strided, (word *C, size_t addr, size_t stride, size_t plane, int n, int *response),
+	accumulate_strided(C, addr, stride, plane, n, response))
+
+
+
+// ---------- Thread pool ----------
+
+// Worker threads executing the tasks 0 to ntasks-1 of one job at a time.
+// threadpool_run returns when all tasks are finished. Used to split large reads.
+
+struct ThreadPool
+	{
+	pthread_t *threads;
+	int nthreads;
+	
+	pthread_mutex_t lock, job;	// lock guards the fields below, job serializes callers
+	pthread_cond_t start, done;
+	
+	void (*fn) (void *, int);	// current job
+	void *arg;
+	int ntasks, next, finished, generation, quit;
+	};
+
+
+static void* threadpool_worker (void *arg)
+	{
+	ThreadPool *P = (ThreadPool*) arg;
+	int generation = 0;
+	
+	pthread_mutex_lock(&P->lock);
+	for (;;)
+		{
+		while (P->generation == generation && ! P->quit)
+			pthread_cond_wait(&P->start, &P->lock);
+		if (P->quit) break;
+		
+		generation = P->generation;
+		while (P->next < P->ntasks)
+			{
+			int task = P->next++;
+			pthread_mutex_unlock(&P->lock);
+			P->fn(P->arg, task);
+			pthread_mutex_lock(&P->lock);
+			if (++P->finished == P->ntasks)
+				pthread_cond_signal(&P->done);
+			}
+		}
+	pthread_mutex_unlock(&P->lock);
+	return 0;
+	}
+
+
+ThreadPool *threadpool_new (int nthreads, const int *cpus)
+	{
+	if (nthreads < 1) return 0;
+	
+	ThreadPool *P = (ThreadPool*) calloc(1, sizeof(ThreadPool));
+	if (! P) return 0;
+	
+	P->threads = (pthread_t*) malloc(nthreads * sizeof(pthread_t));
+	if (! P->threads) { free(P); return 0; }
+	
+	pthread_mutex_init(&P->lock, 0);
+	pthread_mutex_init(&P->job, 0);
+	pthread_cond_init(&P->start, 0);
+	pthread_cond_init(&P->done, 0);
+	
+	for (int i = 0; i < nthreads; i++)
+		{
+		if (pthread_create(&P->threads[i], 0, threadpool_worker, P)) break; // keep the workers started so far
+		P->nthreads = i + 1;
+		
+#if defined(__linux__)
+		if (cpus) // pin worker i to cpus[i]
+			{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i], &set);
+			pthread_setaffinity_np(P->threads[i], sizeof(set), &set);
+			}
+#endif
+		}
+	
+	if (P->nthreads == 0) // no worker could be started
+		{
+		threadpool_delete(P);
+		return 0;
+		}
+	
+	return P;
+	}
+	
+	
+void threadpool_delete (ThreadPool *P)
+	{
+	pthread_mutex_lock(&P->lock);
+	P->quit = 1;
+	pthread_cond_broadcast(&P->start);
+	pthread_mutex_unlock(&P->lock);
+	
+	for (int i = 0; i < P->nthreads; i++)
+		pthread_join(P->threads[i], 0);
+	
+	pthread_mutex_destroy(&P->lock);
+	pthread_mutex_destroy(&P->job);
+	pthread_cond_destroy(&P->start);
+	pthread_cond_destroy(&P->done);
+	free(P->threads);
+	free(P);
+	}
+	
+	
+#if defined(__linux__)
+
+// reads a sysfs list of numbers such as "0-3,8-11", returns the number of entries stored in out
+
+static int read_list (const char *path, int *out, int max)
+	{
+	FILE *f = fopen(path, "r");
+	if (! f) return 0;
+	
+	int n = 0, first, last;
+	while (fscanf(f, "%d", &first) == 1)
+		{
+		last = first;
+		if (fgetc(f) == '-' && fscanf(f, "%d", &last) == 1) fgetc(f);
+		for (int i = first; i <= last && n < max; i++) out[n++] = i;
+		}
+		
+	fclose(f);
+	return n;
+	}
+	
+#endif
+
+
+// CPU numbers taken from the NUMA nodes in turn, for threadpool_new
+// worker threads spread this way match storage pages interleaved across nodes (TM_INTERLEAVE)
+
+int threadpool_spread_cpus (int *cpus, int n)
+	{
+	int count = 0;
+	
+#if defined(__linux__)
+	int nodes[CPU_SETSIZE], nodecpus[CPU_SETSIZE], order[CPU_SETSIZE], rank[CPU_SETSIZE];
+	int nnodes = read_list("/sys/devices/system/node/online", nodes, CPU_SETSIZE);
+	
+	for (int i = 0; i < nnodes; i++) // order the CPUs by their rank within the node, then by node
+		{
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+		int m = read_list(path, nodecpus, CPU_SETSIZE);
+		
+		for (int k = 0; k < m && count < CPU_SETSIZE; k++)
+			{
+			int c = count++;
+			while (c > 0 && rank[c-1] > k) // insertion by rank, stable across nodes
+				{
+				order[c] = order[c-1];
+				rank[c] = rank[c-1];
+				c--;
+				}
+			order[c] = nodecpus[k];
+			rank[c] = k;
+			}
+		}
+		
+	for (int i = 0; count && i < n; i++)
+		cpus[i] = order[i % count];
+#endif
+
+	return count > 0;
+	}
+
+
+static void threadpool_run (ThreadPool *P, void (*fn) (void *, int), void *arg, int ntasks)
+	{
+	pthread_mutex_lock(&P->job);
+	pthread_mutex_lock(&P->lock);
+	
+	P->fn = fn;
+	P->arg = arg;
+	P->ntasks = ntasks;
+	P->next = P->finished = 0;
+	P->generation ++;
+	pthread_cond_broadcast(&P->start);
+	
+	while (P->finished < ntasks)
+		pthread_cond_wait(&P->done, &P->lock);
+	
+	pthread_mutex_unlock(&P->lock);
+	pthread_mutex_unlock(&P->job);
+	}
+
+
+
+// ---------- Triadic Memory -- stores triple associations (x,y,z}  ----------
+
+
+// storage rows are padded to whole 64-bit words, so that they can be read one word at a time
+
+static int padded (int n)
+	{ return (n + 63) / 64 * 64; }
+
+
+// zero-initialized storage in one piece
+// with TM_HUGEPAGES, backed by 2 MB pages where the system provides them (Linux): explicit huge pages
+// from the hugetlbfs pool, or else transparent huge pages, or else normal pages
+// with TM_INTERLEAVE, the pages are distributed round-robin across the NUMA nodes (Linux)
+
+#define HUGEPAGE_BYTES	((size_t) 2 << 20)
+#define MPOL_INTERLEAVE	3		// memory policy for mbind, see numaif.h
+
+enum { BACKING_DEFAULT, BACKING_TRANSPARENT, BACKING_HUGETLB };
+
+static const char *backingnames[] = { "4 KB pages", "transparent huge pages", "huge pages" };
+
+
+#if defined(__linux__)
+
+static void interleave (void *p, size_t size)
+	{
+	int nodes[CPU_SETSIZE], nnodes = read_list("/sys/devices/system/node/online", nodes, CPU_SETSIZE);
+	unsigned long mask[CPU_SETSIZE / (8 * sizeof(long))] = {0};
+	
+	if (nnodes < 2) return; // nothing to distribute
+	
+	for (int i = 0; i < nnodes; i++)
+		mask[nodes[i] / (8 * sizeof(long))] |= 1ul << nodes[i] % (8 * sizeof(long));
+		
+	syscall(SYS_mbind, p, size, MPOL_INTERLEAVE, mask, CPU_SETSIZE, 0); // on failure, pages stay local
+	}
+	
+#endif
+
+
+static word* storage_alloc (size_t bytes, int flags, int *backing)
+	{
+	*backing = BACKING_DEFAULT;
+	
+#if defined(__linux__) && defined(MAP_HUGETLB) && defined(MADV_HUGEPAGE)
+	if (flags & (TM_HUGEPAGES | TM_INTERLEAVE))
+		{
+		size_t size = (bytes + HUGEPAGE_BYTES - 1) / HUGEPAGE_BYTES * HUGEPAGE_BYTES;
+		
+		void *p = flags & TM_HUGEPAGES ?
+			mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0) : MAP_FAILED;
+		
+		if (p != MAP_FAILED)
+			*backing = BACKING_HUGETLB;
+		
+		else // transparent huge pages only cover 2 MB aligned ranges
+			{
+			p = mmap(0, size + HUGEPAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				return 0;
+				
+			p = (void*) (((uintptr_t) p + HUGEPAGE_BYTES - 1) & ~(HUGEPAGE_BYTES - 1));
+			if ((flags & TM_HUGEPAGES) && madvise(p, size, MADV_HUGEPAGE) == 0)
+				*backing = BACKING_TRANSPARENT;
+			}
+			
+		if (flags & TM_INTERLEAVE) // before the first touch, which places the pages
+			interleave (p, size);
+		
+		return (word*) p;
+		}
+#endif
+
+	return (word*) calloc(bytes / sizeof(word), sizeof(word));
+	}
+	
+
+// a cube is either allocated in one piece, or (TM_SPARSE) in pages of whole rows on first write
+// pages are installed with compare-and-swap, so that concurrent writers agree on one page
+
+#define PAGE_BITS	(1 << 12)	// page size in bits (512 bytes), at least one row
+
+static void cube_init (Cube *c, size_t nrows, int n, int flags)
+	{
+	c->nrows = nrows;
+	c->rowlen = padded(n);
+	c->rowwords = TM_CELLBITS * c->rowlen / 64;
+	c->pagerows = PAGE_BITS / (64 * c->rowwords) > 0 ? PAGE_BITS / (64 * c->rowwords) : 1;
+	c->npages = (nrows + c->pagerows - 1) / c->pagerows;
+	c->backing = BACKING_DEFAULT;
+	
+	if (flags & TM_SPARSE)
+		{
+		c->bits = 0;
+		c->pages = (word**) calloc( c->npages, sizeof(word*));
+		}
+	else
+		{
+		c->bits = storage_alloc (nrows * c->rowwords * sizeof(word), flags, &c->backing);
+		c->pages = 0;
+		}
+	}
+
+
+// storage row, 0 if it lies in a page that was never written
+
+static inline word* cube_row (Cube *c, size_t row)
+	{
+	if (c->bits)
+		return c->bits + (size_t) c->rowwords * row;
+		
+	word *page = __atomic_load_n (&c->pages[row / c->pagerows], __ATOMIC_ACQUIRE);
+	return page ? page + c->rowwords * (row % c->pagerows) : 0;
+	}
+
+
+// storage row for writing, allocates its page if necessary
+
+static inline word* cube_row_alloc (Cube *c, size_t row)
+	{
+	word *r = cube_row(c, row);
+	if (r) return r;
+	
+	word *page = (word*) calloc( (size_t) c->pagerows * c->rowwords, sizeof(word)), *installed = 0;
+	
+	if (! __atomic_compare_exchange_n (&c->pages[row / c->pagerows], &installed, page, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+		free(page); // another thread was first
+		page = installed;
+		}
+		
+	return page + c->rowwords * (row % c->pagerows);
+	}
+
+
+TriadicMemory *triadicmemory_new(int n, int p)
+	{
+	return triadicmemory_new3 (n, p, n, p, n, p);
+	}
+
+TriadicMemory *triadicmemory_new3 (int nx, int px, int ny, int py, int nz, int pz)
+	{
+	return triadicmemory_new_flags (nx, px, ny, py, nz, pz, 0);
+	}
+
+TriadicMemory *triadicmemory_new_flags (int nx, int px, int ny, int py, int nz, int pz, int flags)
+	{
+	TriadicMemory *T = malloc(sizeof(TriadicMemory));
+		
+	T->nx = nx;		// vector dimensions of x, y, and z
+	T->ny = ny;
+	T->nz = nz;
+	T->px = px;		// target sparse populations of x, y, and z
+	T->py = py;
+	T->pz = pz;
+	
+	T->forgetting = 0; 	// random forgetting is an experimental feature, disabled by default
+	T->decay = 1;
+	T->rng = random_next(random_thread());
+	T->debt = 0;
+	T->flags = flags;
+	T->pool = 0;		// no worker threads, reads are single-threaded
+	
+	// allocate and initialize the entire storage cube, TM_CELLBITS bits per location
+	// limitation: calloc may fail for large n, use TM_SPARSE or virtual memory instead in this case
+	
+	cube_init (&T->C, (size_t) nx * ny, nz, flags);
+	
+	// the transposed copies hold the same bits, arranged so that read_x and read_y scan contiguous rows
+	
+	memset(&T->Cx, 0, sizeof(Cube));
+	memset(&T->Cy, 0, sizeof(Cube));
+	if (flags & TM_ORIENTED)
+		{
+		cube_init (&T->Cx, (size_t) ny * nz, nx, flags);
+		cube_init (&T->Cy, (size_t) nx * nz, ny, flags);
+		}
+	
+	return T;
+	}
+	
+	
+static size_t cube_storage (Cube *c)
+	{
+	size_t pagebytes = (size_t) c->pagerows * c->rowwords * sizeof(word), n = 0;
+	
+	if (c->bits)
+		return c->nrows * c->rowwords * sizeof(word);
+		
+	for (size_t i = 0; i < c->npages; i++)
+		if (__atomic_load_n (&c->pages[i], __ATOMIC_ACQUIRE)) n++;
+		
+	return n * pagebytes + c->npages * sizeof(word*);
+	}
+
+size_t triadicmemory_storage (TriadicMemory *T)
+	{
+	return cube_storage(&T->C) + cube_storage(&T->Cx) + cube_storage(&T->Cy);
+	}
+	
+const char* triadicmemory_backing (TriadicMemory *T)
+	{
+	return backingnames[T->C.backing];
+	}
+	
+
+// prefaulting: each task touches one word per 4 KB page of a slice of the storage
+// an atomic or with 0 maps the page for writing without changing any bits, so that it is safe at any time
+
+#define PREFAULT_WORDS	512	// 4 KB
+#define PREFAULT_TASKS	64	// slices per cube
+
+typedef struct { word *bits; size_t nwords; } PrefaultJob;
+
+static void prefault_task (void *arg, int task)
+	{
+	PrefaultJob *J = (PrefaultJob*) arg;
+	size_t first = J->nwords * task / PREFAULT_TASKS, last = J->nwords * (task + 1) / PREFAULT_TASKS;
+	
+	for (size_t w = first / PREFAULT_WORDS * PREFAULT_WORDS; w < last; w += PREFAULT_WORDS)
+		__atomic_fetch_or (&J->bits[w], 0, __ATOMIC_RELAXED);
+	}
+	
+void triadicmemory_prefault (TriadicMemory *T)
+	{
+	Cube *cubes[] = { &T->C, &T->Cx, &T->Cy };
+	
+	for (int i = 0; i < 3; i++) if (cubes[i]->bits) // paged cubes (TM_SPARSE) are allocated on demand
+		{
+		PrefaultJob J = { cubes[i]->bits, cubes[i]->nrows * cubes[i]->rowwords };
+		
+		if (T->pool)
+			threadpool_run (T->pool, prefault_task, &J, PREFAULT_TASKS);
+		else for (int task = 0; task < PREFAULT_TASKS; task++)
+			prefault_task (&J, task);
+		}
+	}
+	
+	
+// cube updates: in concurrent mode (TM_CONCURRENT), atomic read-modify-write of whole words
+// with relaxed memory ordering, see triadicmemory.h
+// a write increments the cells addressed by a triple, a delete decrements them (rows never written are skipped)
+
+KERNEL void tm_update (TriadicMemory *T, SDR *x, SDR *y, SDR *z, int inc)
+	{
+	int atomic = T->flags & TM_CONCURRENT;
+
+	// original triadic memory write algorithm, with storage cells of TM_CELLBITS bits
+
+	for (int i = 0; i < x->p; i++) for (int j = 0; j < y->p; j++)
+		{
+		word *row = inc ? cube_row_alloc(&T->C, (size_t) T->ny * x->a[i] + y->a[j])
+				: cube_row(&T->C, (size_t) T->ny * x->a[i] + y->a[j]);
+		if (row) for (int k = 0; k < z->p; k++)
+			cell_update(row, T->C.rowlen / 64, z->a[k], atomic, inc);
+		}
+		
+	if (T->flags & TM_ORIENTED) for (int j = 0; j < y->p; j++) for (int k = 0; k < z->p; k++)
+		{
+		word *row = inc ? cube_row_alloc(&T->Cx, (size_t) T->nz * y->a[j] + z->a[k])	// row (y,z) in Cx
+				: cube_row(&T->Cx, (size_t) T->nz * y->a[j] + z->a[k]);
+		if (row) for (int i = 0; i < x->p; i++)
+			cell_update(row, T->Cx.rowlen / 64, x->a[i], atomic, inc);
+		}
+
+	if (T->flags & TM_ORIENTED) for (int i = 0; i < x->p; i++) for (int k = 0; k < z->p; k++)
+		{
+		word *row = inc ? cube_row_alloc(&T->Cy, (size_t) T->nz * x->a[i] + z->a[k])	// row (x,z) in Cy
+				: cube_row(&T->Cy, (size_t) T->nz * x->a[i] + z->a[k]);
+		if (row) for (int j = 0; j < y->p; j++)
+			cell_update(row, T->Cy.rowlen / 64, y->a[j], atomic, inc);
+		}
+	}
+	
+KERNEL_VARIANTS (void, tm_write,  (TriadicMemory *T, SDR *x, SDR *y, SDR *z), tm_update(T, x, y, z, 1))
+KERNEL_VARIANTS (void, tm_delete, (TriadicMemory *T, SDR *x, SDR *y, SDR *z), tm_update(T, x, y, z, 0))
+
+
+// the following is not part of the original triadic memory algorithm and disabled by default
+// random forgetting, realized by decrementing decay times as many memory locations as were written (but not below zero)
+// this has no measurable effect for an almost empty memory
+
+// writes add to a forgetting debt, which is paid in sweeps of FORGET_SWEEP random locations
+// the locations of a sweep lie in one random tile of 16 x 16 x 64 locations, which spans a single 64-bit word
+// per row in each cube, so that a sweep touches a few hundred cache lines instead of missing the cache at every location
+// the tile is drawn uniformly, and the locations within it are distinct, given by a random permutation of the tile,
+// so that every location is equally likely to be hit, and as likely to hold a bit as with independent draws
+
+#define FORGET_TILE	16	// tile size in x and y
+#define FORGET_CELLS	(1 << 14)	// locations per tile
+#define FORGET_SWEEP	4096	// locations per sweep, at most FORGET_CELLS
+#define FORGET_UNIT	65536	// debt per location
+#define FORGET_INTERLEAVE 256	// batch writes forget after writing at most 1/256 of the cube
+
+static int forget_sweep (TriadicMemory *T) // returns the number of locations inside the cube
+	{
+	int atomic = T->flags & TM_CONCURRENT, oriented = T->flags & TM_ORIENTED;
+	
+	// seed of the sweep, taken from the memory's generator with an atomic add so that concurrent writers get distinct seeds
+	uint64_t s = __atomic_fetch_add (&T->rng, 0x9e3779b97f4a7c15ull, __ATOMIC_RELAXED);
+	
+	int x0 = FORGET_TILE * (int) (splitmix64(&s) % ((T->nx + FORGET_TILE - 1) / FORGET_TILE));
+	int y0 = FORGET_TILE * (int) (splitmix64(&s) % ((T->ny + FORGET_TILE - 1) / FORGET_TILE));
+	int z0 = 64 * (int) (splitmix64(&s) % ((T->nz + 63) / 64));
+	
+	// rows of the tile, 0 outside of the cube or in pages never written (which hold no bits to clear)
+	
+	word *C[FORGET_TILE][FORGET_TILE], *Cx[FORGET_TILE][64], *Cy[FORGET_TILE][64];
+	
+	for (int i = 0; i < FORGET_TILE; i++) for (int j = 0; j < FORGET_TILE; j++)
+		C[i][j] = x0 + i < T->nx && y0 + j < T->ny ? cube_row(&T->C, (size_t) T->ny * (x0 + i) + y0 + j) : 0;
+		
+	if (oriented) for (int i = 0; i < FORGET_TILE; i++) for (int k = 0; k < 64; k++)
+		{
+		Cx[i][k] = y0 + i < T->ny && z0 + k < T->nz ? cube_row(&T->Cx, (size_t) T->nz * (y0 + i) + z0 + k) : 0;
+		Cy[i][k] = x0 + i < T->nx && z0 + k < T->nz ? cube_row(&T->Cy, (size_t) T->nz * (x0 + i) + z0 + k) : 0;
+		}
+	
+	// permutation of the tile: random offset, then multiplications by odd numbers and xor-shifts, all invertible
+	
+	uint64_t r = splitmix64(&s);
+	unsigned int b = (unsigned int) r, m1 = (unsigned int) (r >> 20) | 1, m2 = (unsigned int) (r >> 40) | 1;
+	
+	int inside = 0;
+	
+	for (unsigned int n = 0; n < FORGET_SWEEP; n++)
+		{
+		unsigned int c = (n + b) * m1 % FORGET_CELLS;
+		c = (c ^ c >> 7) * m2 % FORGET_CELLS;
+		c ^= c >> 5;
+		
+		int i = c & 15, j = c >> 4 & 15, l = c >> 8; // 4 + 4 + 6 bits
+		
+		if (x0 + i >= T->nx || y0 + j >= T->ny || z0 + l >= T->nz) // outside of an edge tile
+			continue;
+		
+		inside++;
+		
+		if (C[i][j])
+			cell_dec(C[i][j], T->C.rowlen / 64, z0 + l, atomic);
+		
+		if (oriented) // decrement the same location in the transposed copies
+			{
+			if (Cx[j][l])
+				cell_dec(Cx[j][l], T->Cx.rowlen / 64, x0 + i, atomic);
+			if (Cy[i][l])
+				cell_dec(Cy[i][l], T->Cy.rowlen / 64, y0 + j, atomic);
+			}
+		}
+		
+	return inside;
+	}
+	
+static void forget (TriadicMemory *T, size_t written)
+	{
+	uint64_t due = (uint64_t) (T->decay * FORGET_UNIT * written), unit = (uint64_t) FORGET_SWEEP * FORGET_UNIT;
+	
+	while (due)
+		{
+		uint64_t debt = __atomic_add_fetch (&T->debt, due, __ATOMIC_RELAXED);
+		uint64_t sweeps = debt / unit - (debt - due) / unit; // sweeps completed by this write
+		
+		for (due = 0; sweeps > 0; sweeps--) // locations outside of the cube are owed again
+			due += (uint64_t) (FORGET_SWEEP - forget_sweep(T)) * FORGET_UNIT;
+		}
+	}
+	
+	
+void triadicmemory_write (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+	{
+	K.tm_write(T, x, y, z);
+	
+	if (T->forgetting)
+		forget (T, (size_t) x->p * y->p * z->p);
+	}
+	
+void triadicmemory_delete (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+	{
+#if TM_CELLBITS == 1
+	(void) T; (void) x; (void) y; (void) z; // a 1-bit cell may also hold the bit of another association
+#else
+	K.tm_delete(T, x, y, z);
+#endif
+	}
+	
+	
+	
+// batch writes: the storage rows touched by a block of triples are partitioned by cube region
+// and then written region by region, with regions distributed across the workers of T->pool
+// tasks never share a storage word, and the result does not depend on the order of writes
+
+#define WRITE_BLOCK	16384	// triples expanded at a time
+#define REGION_BITS	(1 << 18)	// approximate region size in bits (32 KB)
+
+typedef struct { size_t row; int t; } RowWrite;	// increment the cells c[t] of row
+
+typedef struct
+	{
+	Cube *C;
+	int atomic;		// concurrent mode
+	SDR **c;
+	RowWrite *writes;	// row writes, sorted by region
+	int *start;		// writes of region r are writes[start[r]] to writes[start[r+1]-1]
+	} WriteJob;
+	
+typedef struct
+	{
+	RowWrite *writes, *sorted; int nwrites, nsorted;
+	int *start, nstart;
+	} WriteBuffers;
+
+
+static void write_task (void *arg, int region)
+	{
+	WriteJob *J = (WriteJob*) arg;
+	
+	for (int i = J->start[region]; i < J->start[region + 1]; i++)
+		{
+		SDR *c = J->c[J->writes[i].t];
+		word *row = cube_row_alloc(J->C, J->writes[i].row);
+		
+		for (int k = 0; k < c->p; k++)
+			cell_inc(row, J->C->rowlen / 64, c->a[k], J->atomic);
+		}
+	}
+
+
+// for a block of triples (a, b, c), increment cells c[k] in rows nb * a[i] + b[j] of cube C
+
+static void write_block (ThreadPool *pool, Cube *C, int nb, int atomic,
+	SDR **a, SDR **b, SDR **c, int count, WriteBuffers *buf)
+	{
+	int n = 0, rowsperregion = REGION_BITS / (64 * C->rowwords) + 1, nregions = (int) (C->nrows / rowsperregion) + 1;
+	
+	for (int t = 0; t < count; t++)
+		n += a[t]->p * b[t]->p;
+		
+	RowWrite *writes = buf->writes = (RowWrite*) grow(buf->writes, &buf->nwrites, n, sizeof(RowWrite));
+	RowWrite *sorted = buf->sorted = (RowWrite*) grow(buf->sorted, &buf->nsorted, n, sizeof(RowWrite));
+	int *start       = buf->start  = (int*) grow(buf->start, &buf->nstart, nregions + 1, sizeof(int));
+	
+	memset(start, 0, (nregions + 1) * sizeof(int));
+	
+	n = 0;
+	for (int t = 0; t < count; t++)
+		for (int i = 0; i < a[t]->p; i++) for (int j = 0; j < b[t]->p; j++)
+			{
+			writes[n].row = (size_t) nb * a[t]->a[i] + b[t]->a[j];
+			writes[n].t = t;
+			start[writes[n++].row / rowsperregion + 1] ++;
+			}
+	
+	for (int r = 0; r < nregions; r++)
+		start[r + 1] += start[r];
+		
+	for (int i = 0; i < n; i++) // counting sort by region, shifting start[r] to the end of region r
+		sorted[start[writes[i].row / rowsperregion]++] = writes[i];
+		
+	for (int r = nregions; r > 0; r--)
+		start[r] = start[r - 1];
+	start[0] = 0;
+	
+	WriteJob J = { .C = C, .atomic = atomic, .c = c, .writes = sorted, .start = start };
+	
+	if (pool)
+		threadpool_run (pool, write_task, &J, nregions);
+	else for (int r = 0; r < nregions; r++)
+		write_task (&J, r);
+	}
+	
+	
+void triadicmemory_write_batch (TriadicMemory *T, SDR **x, SDR **y, SDR **z, int count)
+	{
+	WriteBuffers buf = {0};
+	int atomic = T->flags & TM_CONCURRENT;
+		
+	for (int t = 0, m; t < count; t += m)
+		{
+		size_t written = 0, limit = (size_t) T->nx * T->ny * T->nz / FORGET_INTERLEAVE;
+		
+		for (m = 0; t + m < count && m < WRITE_BLOCK; m++) // with forgetting, blocks write at most limit locations
+			{
+			if (T->forgetting && m > 0 && written >= limit) break;
+			written += (size_t) x[t+m]->p * y[t+m]->p * z[t+m]->p;
+			}
+		
+		write_block (T->pool, &T->C, T->ny, atomic, x+t, y+t, z+t, m, &buf);
+		
+		if (T->flags & TM_ORIENTED)
+			{
+			write_block (T->pool, &T->Cx, T->nz, atomic, y+t, z+t, x+t, m, &buf);
+			write_block (T->pool, &T->Cy, T->nz, atomic, x+t, z+t, y+t, m, &buf);
+			}
+			
+		if (T->forgetting) // forgetting as for single writes, once per block
+			forget (T, written);
+		}
+		
+	free(buf.writes);
+	free(buf.sorted);
+	free(buf.start);
+	}
+	
+		
+
+// reads of large memories can be split across the worker threads of a pool
+// each task accumulates a separate slice of the response vector
+
+#define SLICE_WORDS	64	// minimum slice for contiguous rows, in 64-bit words
+#define SLICE_POSITIONS	256	// minimum slice for strided reads
+#define STRIDED_BLOCK	32	// positions per block of a strided read
+
+typedef struct
+	{
+	word **rows; int nrows;				// contiguous rows
+	Cube *C; SDR *a, *b; size_t Ra, Rs;		// strided reads of bits b[j] in rows Ra * a[i] + Rs * position
+	int n, ntasks, *response;			// n: number of words (the plane size of a row) or positions to split
+	} ReadJob;
+	
+
+static int slice_tasks (ThreadPool *pool, int n, int minslice)
+	{
+	int ntasks = pool ? n / minslice : 1;
+	if (pool && ntasks > pool->nthreads) ntasks = pool->nthreads;
+	return ntasks < 1 ? 1 : ntasks;
+	}
+	
+static void rows_task (void *arg, int task)
+	{
+	ReadJob *J = (ReadJob*) arg;
+	K.accumulate_rows (J->rows, J->nrows, J->n, J->n * task / J->ntasks, J->n * (task + 1) / J->ntasks, J->response);
+	}
+	
+static void strided_task (void *arg, int task)
+	{
+	ReadJob *J = (ReadJob*) arg;
+	size_t rowbits = 64 * J->C->rowwords, plane = J->C->rowlen;
+	
+	// slice boundaries on multiples of 16 positions, so that tasks don't share cache lines of the response
+	int first = J->n * task / J->ntasks / 16 * 16;
+	int last  = task == J->ntasks - 1 ? J->n : J->n * (task + 1) / J->ntasks / 16 * 16;
+	
+	// positions in consecutive rows (read_y) and paged cubes are read row by row, one page lookup per row
+	// otherwise, the positions are processed in blocks so that the pages of a block stay in the TLB
+	// while all bits of a and b are collected
+	
+	if (J->C->bits && J->Rs > 1) for (int block = first; block < last; block += STRIDED_BLOCK)
+		{
+		int m = last - block < STRIDED_BLOCK ? last - block : STRIDED_BLOCK;
+		for (int i = 0; i < J->a->p; i++) for (int j = 0; j < J->b->p; j++)
+			K.accumulate_strided (J->C->bits, rowbits * (J->Ra * J->a->a[i] + J->Rs * block) + J->b->a[j],
+				rowbits * J->Rs, plane, m, J->response + block);
+		}
+	
+	else for (int pos = first; pos < last; pos++)
+		{
+		int sum = 0;
+		for (int i = 0; i < J->a->p; i++)
+			{
+			word *row = cube_row(J->C, J->Ra * J->a->a[i] + J->Rs * pos);
+			if (row) for (int j = 0; j < J->b->p; j++)
+				sum += cell_get(row, plane / 64, J->b->a[j]);
+			}
+		J->response[pos] += sum;
+		}
+	}
+
+
+static void read_rows (ThreadPool *pool, word **rows, int nrows, int nwords, int *response)
+	{
+	ReadJob J = { .rows = rows, .nrows = nrows, .n = nwords, .response = response };
+	
+	J.ntasks = slice_tasks(pool, nwords, SLICE_WORDS);
+	
+	if (J.ntasks == 1)
+		K.accumulate_rows (rows, nrows, nwords, 0, nwords, response);
+	else
+		threadpool_run (pool, rows_task, &J, J.ntasks);
+	}
+
+static void read_strided (ThreadPool *pool, Cube *C, SDR *a, size_t Ra, SDR *b, size_t Rs, int n, int *response)
+	{
+	ReadJob J = { .C = C, .a = a, .b = b, .Ra = Ra, .Rs = Rs, .n = n, .response = response };
+	
+	J.ntasks = slice_tasks(pool, n, SLICE_POSITIONS);
+	
+	if (J.ntasks == 1)
+		strided_task (&J, 0);
+	else
+		threadpool_run (pool, strided_task, &J, J.ntasks);
+	}
+
+
+
+// triadic memory read algorithm, modified for storage cells of TM_CELLBITS bits
+
+// there is a query function for x, y, and z, respectively
+// weights are collected into an response vector
+// the function binarize converts the response vector to a binary SDR with the specified target population
+// note that the result can have a population less or greater than specified
+
+
+static SDR* read_x (TriadicMemory *T, SDR *x, SDR *y, SDR *z, Workspace *W, ThreadPool *pool)
+	{
+	if (T->flags & TM_ORIENTED) // contiguous rows in the x-major copy
+		{
+		int* response = workspace_response(W, T->Cx.rowlen);
+		word **rows = workspace_rows(W, y->p * z->p), *row;
+		int nrows = 0;
+		
+		for (int j = 0; j < y->p; j++) for (int k = 0; k < z->p; k++)
+			if ((row = cube_row(&T->Cx, (size_t) T->nz * y->a[j] + z->a[k])))
+				rows[nrows++] = row;
+		
+		read_rows (pool, rows, nrows, T->Cx.rowlen / 64, response);
+		return binarize(x, response, T->px, W);
+		}
+
+	int* response = workspace_response(W, T->nx);
+
+	read_strided (pool, &T->C, y, 1, z, T->ny, T->nx, response);	// rows (x,y)
+
+	return binarize(x, response, T->px, W);
+	}
+
+
+static SDR* read_y (TriadicMemory *T, SDR *x, SDR *y, SDR *z, Workspace *W, ThreadPool *pool)
+	{
+	if (T->flags & TM_ORIENTED) // contiguous rows in the y-major copy
+		{
+		int* response = workspace_response(W, T->Cy.rowlen);
+		word **rows = workspace_rows(W, x->p * z->p), *row;
+		int nrows = 0;
+		
+		for (int i = 0; i < x->p; i++) for (int k = 0; k < z->p; k++)
+			if ((row = cube_row(&T->Cy, (size_t) T->nz * x->a[i] + z->a[k])))
+				rows[nrows++] = row;
+		
+		read_rows (pool, rows, nrows, T->Cy.rowlen / 64, response);
+		return binarize(y, response, T->py, W);
+		}
+		
+	int* response = workspace_response(W, T->ny);
+		
+	read_strided (pool, &T->C, x, T->ny, z, 1, T->ny, response);	// rows (x,y)
+
+	return binarize(y, response, T->py, W);
+	}
+
+
+
+static SDR* read_z (TriadicMemory *T, SDR *x, SDR *y, SDR *z, Workspace *W, ThreadPool *pool)
+	{
+	int* response = workspace_response(W, T->C.rowlen);
+	word **rows = workspace_rows(W, x->p * y->p), *row;
+	int nrows = 0;
+	
+	// rows in pages that were never written (TM_SPARSE) are all zero and skipped
+	
+	for (int i = 0; i < x->p; i++) for (int j = 0; j < y->p; j++)
+		if ((row = cube_row(&T->C, (size_t) T->ny * x->a[i] + y->a[j])))
+			rows[nrows++] = row;
+	
+	read_rows (pool, rows, nrows, T->C.rowlen / 64, response);
+	return binarize(z, response, T->pz, W);
+	}
+	
+	
+SDR* triadicmemory_read_x_ex (TriadicMemory *T, SDR *x, SDR *y, SDR *z, Workspace *W)
+	{
+	return read_x (T, x, y, z, W, T->pool);
+	}
+
+SDR* triadicmemory_read_y_ex (TriadicMemory *T, SDR *x, SDR *y, SDR *z, Workspace *W)
+	{
+	return read_y (T, x, y, z, W, T->pool);
+	}
+
+SDR* triadicmemory_read_z_ex (TriadicMemory *T, SDR *x, SDR *y, SDR *z, Workspace *W)
+	{
+	return read_z (T, x, y, z, W, T->pool);
+	}
+	
+
+SDR* triadicmemory_read_x (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+	{
+	return triadicmemory_read_x_ex (T, x, y, z, default_workspace());
+	}
+
+SDR* triadicmemory_read_y (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+	{
+	return triadicmemory_read_y_ex (T, x, y, z, default_workspace());
+	}
+
+SDR* triadicmemory_read_z (TriadicMemory *T, SDR *x, SDR *y, SDR *z)
+	{
+	return triadicmemory_read_z_ex (T, x, y, z, default_workspace());
+	}
+	
+	
+
+// batch queries: count independent queries given by arrays of SDRs
+// queries are sorted by the first storage row they touch, so that queries sharing bits of x or y
+// (read_z) are processed together and find their rows in cache
+// with a thread pool, contiguous blocks of the sorted queries are distributed across the workers
+// (each using its own workspace, and no further splitting of individual reads)
+
+#define BATCH_BLOCK 64	// queries per task
+
+typedef struct { size_t key; int index; } BatchKey;
+
+typedef struct
+	{
+	TriadicMemory *T;
+	SDR **x, **y, **z;
+	BatchKey *order;
+	int count;
+	SDR* (*read) (TriadicMemory *, SDR *, SDR *, SDR *, Workspace *, ThreadPool *);
+	} BatchJob;
+	
+
+static int cmpkey (const void *a, const void *b)
+	{
+	size_t p = ((BatchKey*)a)->key, q = ((BatchKey*)b)->key;
+	return (p > q) - (p < q);
+	}
+	
+static int firstbit (SDR *s) { return s->p ? s->a[0] : 0; }
+
+static void batch_task (void *arg, int task)
+	{
+	BatchJob *J = (BatchJob*) arg;
+	Workspace *W = default_workspace();
+	
+	int last = (task + 1) * BATCH_BLOCK < J->count ? (task + 1) * BATCH_BLOCK : J->count;
+	
+	for (int q = task * BATCH_BLOCK; q < last; q++)
+		{
+		int i = J->order[q].index;
+		J->read (J->T, J->x[i], J->y[i], J->z[i], W, 0);
+		}
+	}
+	
+	
+static void read_batch (BatchJob *J, SDR **a, int na, SDR **b)
+	{
+	// the sort key is the address of the first row touched, given by the first bits of the two known SDRs
+	
+	J->order = (BatchKey*) malloc(J->count * sizeof(BatchKey));
+	
+	for (int i = 0; i < J->count; i++)
+		{
+		J->order[i].key = (size_t) na * firstbit(a[i]) + firstbit(b[i]);
+		J->order[i].index = i;
+		}
+	
+	qsort(J->order, J->count, sizeof(BatchKey), cmpkey);
+	
+	int ntasks = (J->count + BATCH_BLOCK - 1) / BATCH_BLOCK;
+	
+	if (J->T->pool && ntasks > 1)
+		threadpool_run (J->T->pool, batch_task, J, ntasks);
+	else for (int task = 0; task < ntasks; task++)
+		batch_task (J, task);
+	
+	free(J->order);
+	}
+	
+
+void triadicmemory_read_x_batch (TriadicMemory *T, SDR **x, SDR **y, SDR **z, int count)
+	{
+	BatchJob J = { .T = T, .x = x, .y = y, .z = z, .count = count, .read = read_x };
+	read_batch (&J, y, T->nz, z);
+	}
+
+void triadicmemory_read_y_batch (TriadicMemory *T, SDR **x, SDR **y, SDR **z, int count)
+	{
+	BatchJob J = { .T = T, .x = x, .y = y, .z = z, .count = count, .read = read_y };
+	read_batch (&J, x, T->nz, z);
+	}
+
+void triadicmemory_read_z_batch (TriadicMemory *T, SDR **x, SDR **y, SDR **z, int count)
+	{
+	BatchJob J = { .T = T, .x = x, .y = y, .z = z, .count = count, .read = read_z };
+	read_batch (&J, x, T->ny, y);
+	}
+	
+
+
+// ---------- Item Memory -- finds the stored SDRs nearest to a query ----------
+
+
+// A query counts the overlaps of the items listed at its bits. Ids are counted in blocks of ITEM_BLOCK ids with
+// 16-bit counters that stay in the L1 cache, walking the sorted item lists of the query bits in parallel, and each
+// block is then scanned for the counters reaching the current top-k threshold, which also clears them.
+
+#define ITEM_BLOCKBITS	13
+#define ITEM_BLOCK	(1 << ITEM_BLOCKBITS)
+#define ITEM_MAXBITS	32767	// query bits counted at most, so that counters stay within 15 bits
+
+
+static uint16_t* workspace_counts (Workspace *W) // zero between queries
+	{
+	if (! W->counts) W->counts = (uint16_t*) calloc(ITEM_BLOCK, sizeof(uint16_t));
+	return W->counts;
+	}
+
+static int* workspace_cursors (Workspace *W, int n)
+	{
+	return W->cursors = (int*) grow(W->cursors, &W->ncursors, n, sizeof(int));
+	}
+
+
+// store the counters >= threshold of a block as (count << ITEM_BLOCKBITS) | index into out, zero the counters,
+// and return the number of values stored
+
+static int collect_counts_64 (uint16_t *count, int threshold, int *out)
+	{
+	int m = 0;
+	
+	for (int t = 0; t < ITEM_BLOCK; t += 4) // skip four zero counters at a time
+		{
+		uint64_t w;
+		memcpy(&w, count + t, sizeof w);
+		if (! w) continue;
+		
+		for (int i = t; i < t + 4; i++)
+			if (count[i] >= threshold) out[m++] = count[i] << ITEM_BLOCKBITS | i;
+		memset(count + t, 0, sizeof w);
+		}
+	return m;
+	}
+
+
+#if defined(X86_DISPATCH)
+
+TARGET_AVX2 static int collect_counts_avx2 (uint16_t *count, int threshold, int *out)
+	{
+	const __m256i below = _mm256_set1_epi16((short) (threshold - 1));
+	int m = 0;
+	
+	for (int t = 0; t < ITEM_BLOCK; t += 16)
+		{
+		__m256i c = _mm256_loadu_si256((__m256i*)(count + t));
+		if (_mm256_testz_si256(c, c)) continue;
+		
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpgt_epi16(c, below)) & 0x55555555; // one bit per counter
+		for (; mask; mask &= mask - 1)
+			{
+			int i = t + __builtin_ctz(mask) / 2;
+			out[m++] = count[i] << ITEM_BLOCKBITS | i;
+			}
+		_mm256_storeu_si256((__m256i*)(count + t), _mm256_setzero_si256());
+		}
+	return m;
+	}
+	
+TARGET_AVX512 static int collect_counts_avx512 (uint16_t *count, int threshold, int *out)
+	{
+	const __m512i thr = _mm512_set1_epi16((short) threshold);
+	int m = 0;
+	
+	for (int t = 0; t < ITEM_BLOCK; t += 32)
+		{
+		__m512i c = _mm512_loadu_si512(count + t);
+		if (! _mm512_test_epi16_mask(c, c)) continue;
+		
+		for (__mmask32 mask = _mm512_cmpge_epu16_mask(c, thr); mask; mask &= mask - 1)
+			{
+			int i = t + __builtin_ctz(mask);
+			out[m++] = count[i] << ITEM_BLOCKBITS | i;
+			}
+		_mm512_storeu_si512(count + t, _mm512_setzero_si512());
+		}
+	return m;
+	}
+	
+#endif
+
+
+
+ItemMemory *itemmemory_new (int n)
+	{
+	ItemMemory *M = calloc(1, sizeof(ItemMemory));
+	M->bit = calloc(n, sizeof(ItemList));
+	M->n = n;
+	return M;
+	}
+	
+void itemmemory_delete (ItemMemory *M)
+	{
+	for (int i = 0; i < M->n; i++)
+		free(M->bit[i].ids);
+	for (int id = 0; id < M->maxid; id++)
+		if (M->item[id]) sdr_delete(M->item[id]);
+		
+	free(M->bit);
+	free(M->item);
+	free(M);
+	}
+	
+	
+static void itemlist_insert (ItemList *L, int id)
+	{
+	if (L->n == L->size)
+		{
+		L->size = L->size ? 2 * L->size : 8;
+		L->ids = realloc(L->ids, L->size * sizeof(int));
+		}
+		
+	int i = L->n == 0 || L->ids[L->n - 1] < id ? L->n : gallop(L->ids, 0, L->n, id); // ids are mostly increasing
+	
+	memmove(L->ids + i + 1, L->ids + i, (L->n - i) * sizeof(int));
+	L->ids[i] = id;
+	L->n ++;
+	}
+	
+static void itemlist_remove (ItemList *L, int id)
+	{
+	int i = gallop(L->ids, 0, L->n, id);
+	
+	if (i < L->n && L->ids[i] == id)
+		{
+		memmove(L->ids + i, L->ids + i + 1, (L->n - i - 1) * sizeof(int));
+		L->n --;
+		}
+	}
+	
+	
+void itemmemory_insert (ItemMemory *M, int id, SDR *x)
+	{
+	if (id >= M->maxid)
+		{
+		int maxid = id < 2 * M->maxid ? 2 * M->maxid : id + 1;
+		M->item = realloc(M->item, maxid * sizeof(SDR*));
+		memset(M->item + M->maxid, 0, (maxid - M->maxid) * sizeof(SDR*));
+		M->maxid = maxid;
+		}
+		
+	itemmemory_remove(M, id);
+	
+	SDR *s = M->item[id] = sdr_set(sdr_new_capacity(M->n, x->p), x);
+	for (int i = 0; i < s->p; i++)
+		itemlist_insert(M->bit + s->a[i], id);
+	M->nitems ++;
+	}
+	
+void itemmemory_remove (ItemMemory *M, int id)
+	{
+	SDR *s = itemmemory_item(M, id);
+	if (! s) return;
+	
+	for (int i = 0; i < s->p; i++)
+		itemlist_remove(M->bit + s->a[i], id);
+		
+	sdr_delete(s);
+	M->item[id] = 0;
+	M->nitems --;
+	}
+	
+SDR *itemmemory_item (ItemMemory *M, int id)
+	{
+	return id >= 0 && id < M->maxid ? M->item[id] : 0;
+	}
+	
+	
+int itemmemory_query_ex (ItemMemory *M, SDR *x, int k, int *ids, int *overlaps, Workspace *W)
+	{
+	int bits = x->p < ITEM_MAXBITS ? x->p : ITEM_MAXBITS, found = 0, next = M->maxid;
+	uint16_t *count = workspace_counts(W);
+	int *cursor = workspace_cursors(W, bits + ITEM_BLOCK), *cand = cursor + bits;
+	
+	if (k <= 0) return 0;
+	
+	for (int b = 0; b < bits; b++) // first listed id
+		{
+		ItemList *L = M->bit + x->a[b];
+		cursor[b] = 0;
+		if (L->n && L->ids[0] < next) next = L->ids[0];
+		}
+		
+	while (next < M->maxid) // blocks of ids, skipping blocks without items sharing a bit with x
+		{
+		int base = next & ~(ITEM_BLOCK - 1), end = base + ITEM_BLOCK;
+		next = M->maxid;
+		
+		for (int b = 0; b < bits; b++)
+			{
+			ItemList *L = M->bit + x->a[b];
+			int j = cursor[b];
+			
+			while (j < L->n && L->ids[j] < end)
+				count[L->ids[j++] - base] ++;
+				
+			if (j < L->n && L->ids[j] < next) next = L->ids[j];
+			cursor[b] = j;
+			}
+			
+		int m = K.collect_counts(count, found < k ? 1 : overlaps[k-1] + 1, cand);
+		
+		for (int c = 0; c < m; c++) // candidates by increasing id, insert into the top k
+			{
+			int v = cand[c] >> ITEM_BLOCKBITS;
+			if (found == k && v <= overlaps[k-1]) continue; // ties keep the smaller id
+			
+			int i = found < k ? found++ : k - 1;
+			while (i > 0 && overlaps[i-1] < v)
+				{ ids[i] = ids[i-1]; overlaps[i] = overlaps[i-1]; i--; }
+			ids[i] = base + (cand[c] & (ITEM_BLOCK - 1));
+			overlaps[i] = v;
+			}
+		}
+		
+	return found;
+	}
+	
+int itemmemory_query (ItemMemory *M, SDR *x, int k, int *ids, int *overlaps)
+	{
+	return itemmemory_query_ex(M, x, k, ids, overlaps, default_workspace());
+	}
+
+
+
+// ---------- Command Line Functions ----------
+
+
+
+char* sdr_parse (char *buf, SDR *s)
+	{
+	int *i;
+	s->p = 0;
+	
+	while ( *buf  && *buf != SEPARATOR )
+		{
+		while (isspace(*buf)) buf++;
+		if (! isdigit(*buf)) break;
+		
+		if (s->p == s->cap)
+			{
+			printf("too many positions: %s\n", buf);
+			exit(2);
+			}
+		i = s->a + s->p;
+		sscanf( buf, "%d", i);
+		
+		if ( (*i)-- > s->n || *i < 0 ) // subtracting 1 to convert to C convention
+			{
+			printf("position out of range: %s\n", buf);
+			exit(2);
+			}
+		s->p ++;
+		
+		while (isdigit(*buf)) buf++;
+		while (isspace(*buf)) buf++;
+		}
+		
+	sdr_update_bits(s);
+	return buf;
+	}
+
+
+
+// ---------- Binary protocol ----------
+
+// Input is read in blocks and output is collected in a buffer, which is written out when it gets large
+// or before reading blocks, so that replies to a pipelined stream of requests take few system calls.
+
+
+#define CHANNEL_BLOCK	(1 << 16)	// initial buffer sizes
+#define CHANNEL_FLUSH	(1 << 20)	// output pending before it is written out
+#define CHANNEL_MAXFRAME (1 << 28)
+
+
+static uint32_t get32 (const unsigned char *b)
+	{
+	return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24;
+	}
+
+static void put32 (unsigned char *b, uint32_t v)
+	{
+	b[0] = v; b[1] = v >> 8; b[2] = v >> 16; b[3] = v >> 24;
+	}
+	
+
+Channel *channel_new (int in, int out)
+	{
+	Channel *C = calloc(1, sizeof(Channel));
+	C->in = in;
+	C->out = out;
+	C->ibuf = malloc(C->isize = CHANNEL_BLOCK);
+	C->obuf = malloc(C->osize = CHANNEL_BLOCK);
+	return C;
+	}
+	
+void channel_delete (Channel *C)
+	{
+	channel_flush(C);
+	free(C->ibuf);
+	free(C->obuf);
+	free(C);
+	}
+	
+	
+void channel_flush (Channel *C) // write the completed frames
+	{
+	size_t done = 0;
+	
+	while (done < C->frame)
+		{
+		ssize_t w = write(C->out, C->obuf + done, C->frame - done);
+		if (w < 0 && errno == EINTR) continue;
+		if (w < 0) { perror("channel output"); exit(6); }
+		done += w;
+		}
+		
+	memmove(C->obuf, C->obuf + done, C->olen - done);
+	C->olen -= done;
+	C->frame -= done;
+	}
+	
+	
+static int channel_fill (Channel *C, size_t n) // make n bytes of input available at ipos, 0 if the input ends before
+	{
+	if (C->iend - C->ipos >= n) return 1;
+	
+	channel_flush(C); // the peer may wait for replies before it sends more
+	
+	if (C->ipos + n > C->isize)
+		{
+		memmove(C->ibuf, C->ibuf + C->ipos, C->iend - C->ipos);
+		C->iend -= C->ipos;
+		C->ipos = 0;
+		
+		if (n > C->isize)
+			C->ibuf = realloc(C->ibuf, C->isize = n + CHANNEL_BLOCK);
+		}
+		
+	while (C->iend - C->ipos < n)
+		{
+		ssize_t r = read(C->in, C->ibuf + C->iend, C->isize - C->iend);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return 0;
+		C->iend += r;
+		}
+	return 1;
+	}
+	
+	
+int channel_receive (Channel *C)
+	{
+	if (! channel_fill(C, 4)) return 0;
+	
+	uint32_t len = get32(C->ibuf + C->ipos);
+	if (len > CHANNEL_MAXFRAME)
+		{ fprintf(stderr, "frame too long: %u bytes\n", len); return 0; }
+		
+	if (! channel_fill(C, 4 + (size_t) len)) return 0;
+	
+	unsigned char *f = C->ibuf + C->ipos + 4;
+	C->ipos += 4 + len;
+	
+	C->id = len >= 4 ? get32(f) : 0;
+	C->code = len >= 5 ? f[4] : -1; // frames without opcode are invalid requests
+	C->p = f + (len >= 5 ? 5 : len);
+	C->end = f + len;
+	return 1;
+	}
+	
+int channel_get_uint (Channel *C, uint32_t *v)
+	{
+	uint32_t x = 0;
+	
+	for (int shift = 0; shift < 32 && C->p < C->end; shift += 7)
+		{
+		unsigned char b = *C->p++;
+		x |= (uint32_t) (b & 127) << shift;
+		if (b < 128) { *v = x; return 1; }
+		}
+	return 0;
+	}
+	
+int channel_get_sdr (Channel *C, SDR *s)
+	{
+	uint32_t count, gap, pos = 0;
+	
+	if (! channel_get_uint(C, &count) || count > (uint32_t) s->cap) return 0;
+	
+	for (uint32_t i = 0; i < count; i++)
+		{
+		if (! channel_get_uint(C, &gap) || gap >= (uint32_t) s->n || (i && ! gap)) return 0;
+		
+		pos = i ? pos + gap : gap;
+		if (pos >= (uint32_t) s->n) return 0;
+		s->a[i] = pos;
+		}
+		
+	s->p = count;
+	sdr_update_bits(s);
+	return 1;
+	}
+	
+	
+static void channel_reserve (Channel *C, size_t n)
+	{
+	if (C->olen + n > C->osize)
+		C->obuf = realloc(C->obuf, C->osize = 2 * (C->olen + n));
+	}
+	
+void channel_begin (Channel *C, uint32_t id, int code)
+	{
+	channel_reserve(C, 9);
+	C->frame = C->olen;
+	put32(C->obuf + C->olen + 4, id);
+	C->obuf[C->olen + 8] = code;
+	C->olen += 9; // length is set by channel_end
+	}
+	
+void channel_put_uint (Channel *C, uint32_t v)
+	{
+	channel_reserve(C, 5);
+	
+	for (; v >= 128; v >>= 7)
+		C->obuf[C->olen++] = v | 128;
+	C->obuf[C->olen++] = v;
+	}
+	
+void channel_put_sdr (Channel *C, SDR *s)
+	{
+	channel_put_uint(C, s->p);
+	
+	for (int i = 0; i < s->p; i++)
+		channel_put_uint(C, i ? s->a[i] - s->a[i-1] : s->a[0]);
+	}
+	
+void channel_end (Channel *C)
+	{
+	put32(C->obuf + C->frame, C->olen - C->frame - 4);
+	C->frame = C->olen;
+	
+	if (C->olen >= CHANNEL_FLUSH)
+		channel_flush(C);
+	}
+	
+void channel_error (Channel *C, const char *message)
+	{
+	size_t n = strlen(message);
+	
+	channel_begin(C, C->id, STATUS_ERROR);
+	channel_reserve(C, n);
+	memcpy(C->obuf + C->olen, message, n);
+	C->olen += n;
+	channel_end(C);
+	}
+
+
+
+// ---------- Batch mode of the command line tools ----------
+
+
+#define TEXTINPUT_BLOCK	(1 << 20)	// stdin is read in blocks of this size
+
+
+TextInput *textinput_open (const char *path)
+	{
+	int fd = strcmp(path, "-") ? open(path, O_RDONLY) : 0;
+	if (fd < 0) return 0;
+	
+	TextInput *in = calloc(1, sizeof(TextInput));
+	in->fd = fd;
+	
+	struct stat st;
+	if (fd != 0 && ! fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) // map the whole file
+		{
+		void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		
+		if (map != MAP_FAILED)
+			{
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			in->buf = map;
+			in->size = in->end = st.st_size;
+			in->mapped = in->eof = 1;
+			return in;
+			}
+		}
+		
+	in->buf = malloc(in->size = TEXTINPUT_BLOCK);
+	return in;
+	}
+	
+void textinput_close (TextInput *in)
+	{
+	if (in->mapped)
+		munmap(in->buf, in->size);
+	else
+		free(in->buf);
+		
+	if (in->fd != 0) close(in->fd);
+	free(in);
+	}
+	
+	
+char *textinput_line (TextInput *in, char **end)
+	{
+	size_t scanned = in->start; // input up to here holds no newline
+	char *nl;
+	
+	while (! (nl = memchr(in->buf + scanned, '\n', in->end - scanned)) && ! in->eof)
+		{
+		if (in->start) // move the partial line to the front, grow the buffer if it is full
+			{
+			memmove(in->buf, in->buf + in->start, in->end - in->start);
+			in->end -= in->start;
+			in->start = 0;
+			}
+		else if (in->end == in->size)
+			in->buf = realloc(in->buf, in->size *= 2);
+			
+		scanned = in->end;
+		
+		ssize_t r = read(in->fd, in->buf + in->end, in->size - in->end);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) in->eof = 1;
+		else in->end += r;
+		}
+		
+	if (in->start == in->end) return 0;
+	
+	char *line = in->buf + in->start;
+	*end = nl ? nl + 1 : in->buf + in->end;
+	in->start = *end - in->buf;
+	return line;
+	}
+	
+	
+static inline int space (char c) // isspace for the C locale
+	{
+	return c == ' ' || (unsigned) (c - '\t') <= '\r' - '\t';
+	}
+	
+const char *sdr_scan (const char *buf, const char *end, SDR *s)
+	{
+	s->p = 0;
+	
+	for (;;)
+		{
+		while (buf < end && space(*buf)) buf++;
+		if (buf == end || (unsigned) (*buf - '0') > 9) break;
+		
+		const char *digits = buf;
+		unsigned v = 0;
+		
+		while (buf < end && (unsigned) (*buf - '0') <= 9)
+			v = 10 * v + (*buf++ - '0');
+			
+		if (buf - digits > 9 || v == 0 || v > (unsigned) s->n || s->p == s->cap)
+			return 0;
+		s->a[s->p++] = v - 1;
+		}
+		
+	sdr_update_bits(s);
+	return buf;
+	}
+	
+char *sdr_format (char *out, SDR *s)
+	{
+	for (int r = 0; r < s->p; r++)
+		{
+		char digits[10];
+		int d = 0;
+		
+		for (unsigned v = s->a[r] + 1; v; v /= 10)
+			digits[d++] = '0' + v % 10;
+			
+		if (r) *out++ = ' ';
+		while (d) *out++ = digits[--d];
+		}
+		
+	*out++ = '\n';
+	return out;
+	}
+
+
+
+// ---------- Kernel selection ----------
+
+
+#if defined(X86_DISPATCH)
+#define SELECT(name) (K.level == SIMD_AVX512 ? name##_avx512 : K.level == SIMD_AVX2 ? name##_avx2 : name##_64)
+#else
+#define SELECT(name) name##_64
+#endif
+
+static const char *levelnames[] = { "portable", "avx2", "avx512" };
+
+
+__attribute__((constructor)) static void select_kernels (void)
+	{
+	K.level = SIMD_PORTABLE;
+	
+#if defined(X86_DISPATCH)
+	__builtin_cpu_init();
+	
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")
+		&& __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("lzcnt"))
+		K.level = SIMD_AVX2;
+	
+	if (K.level == SIMD_AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+		&& __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq"))
+		K.level = SIMD_AVX512;
+	
+	char *env = getenv("TRIADICMEMORY_SIMD");  // optional cap on the instruction set level
+	if (env) for (int level = SIMD_PORTABLE; level < K.level; level++)
+		if (! strcmp(env, levelnames[level]))
+			K.level = level;
+#endif
+
+	K.binarize		= SELECT(binarize_kernel);
+	K.sdr_or		= SELECT(sdr_or_kernel);
+	K.sdr_and		= SELECT(sdr_and_kernel);
+	K.overlap		= SELECT(overlap);
+	K.bits_combine		= SELECT(bits_combine);
+	K.collect_counts	= SELECT(collect_counts);
+	
+	
+	K.accumulate_rows	= SELECT(accumulate_rows);
+	K.accumulate_strided	= SELECT(accumulate_strided);
+	K.tm_write		= SELECT(tm_write);
+	K.tm_delete		= SELECT(tm_delete);
+	}
+
+
+const char* triadicmemory_simd (void)
+	{
+	return levelnames[K.level];
 	}
@@ -23,53 +23,161 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 
+#include <stddef.h>
+#include <stdint.h>
+
 
 // ---------- SDR data type and utility functions ----------
 
+typedef uint64_t word;				// represents 64 bits of a bitmap or 64 memory storage locations
 	
 typedef struct
 	{
-	int 	*a,	// indices of non-zero positions, stored in array of size n
+	int 	*a,	// indices of non-zero positions, stored in array of size cap
 		n,	// SDR dimension
-		p; 	// number of non-zero positions
+		p, 	// number of non-zero positions
+		cap;	// capacity of a: functions writing to the SDR keep at most cap positions
+	word	*bits;	// optional dense form, a bitmap of n bits set at the positions in a (0 if not kept)
 	} SDR;
 	
 
-SDR *sdr_new (int n);				// SDR constructor
+SDR *sdr_new (int n);				// SDR constructor, capacity n
+SDR *sdr_new_capacity (int n, int cap);		// SDR holding at most cap positions, e.g. cap = 2p for query results
 void sdr_delete(SDR *);				// destructor
 
 SDR *sdr_random (SDR*, int p);			// random generator
 SDR *sdr_noise (SDR*, int bits);		// add/remove random bits
 
 
+// fast random generator (xoshiro256**) with explicit state, for reproducible and parallel use
+
+typedef struct { uint64_t s[4]; } Random;
+
+void random_seed (Random *, uint64_t seed);	// initialize a generator from a seed
+uint64_t random_next (Random *);		// next 64 random bits
+Random *random_thread (void);			// generator of the calling thread, used by sdr_random and sdr_noise
+						// seeded from the time on first use, call random_seed on it for reproducible runs
+
+SDR *sdr_random_r (SDR*, int p, Random *);	// sdr_random and sdr_noise with a given generator
+SDR *sdr_noise_r (SDR*, int bits, Random *);
+
+
 SDR *sdr_set( SDR *x, SDR *y); 			// copy y to x
 SDR *sdr_rotateright( SDR *x ); 		// shift x right by one bit
 SDR *sdr_rotateleft( SDR *x ); 			// shift x left by one bit
 SDR *sdr_or (SDR*res, SDR *x, SDR *y);		// store bit-wise OR of x and y and res
+SDR *sdr_and (SDR*res, SDR *x, SDR *y);		// store bit-wise AND of x and y and res
 
 int  sdr_equal( SDR*x, SDR*y); 			// whether x and y are identical
 int  sdr_distance( SDR*x, SDR*y); 		// Hamming distance
 int  sdr_overlap( SDR*x, SDR*y); 		// number of common bits
 
 
+// Dense form: an SDR with a bitmap keeps both forms, all functions writing to it update the bitmap.
+// sdr_or, sdr_and, sdr_overlap and sdr_distance work on the bitmaps with SIMD popcounts when both operands
+// have one. Dense SDRs can be passed to all functions, alongside SDRs without bitmap.
+
+SDR *sdr_new_dense (int n);			// SDR with bitmap, capacity n
+SDR *sdr_dense (SDR *);				// add a bitmap to an SDR, or update it after writing to s->a directly
+SDR *sdr_from_bits (SDR *, const word *bits);	// set the positions from a bitmap of n bits
+word *sdr_to_bits (SDR *, word *bits);		// store the positions as a bitmap of n bits, (n + 63) / 64 words
+
+int bits_overlap (const word *x, const word *y, int n);	// number of common bits of two bitmaps of n bits
+int bits_distance (const word *x, const word *y, int n);	// Hamming distance of two bitmaps
+
+
 void sdr_print(SDR *);				// print SDR followed by newline (values 1 to N)
 void sdr_print0(SDR *);				// print SDR followed by newline (values 0 to N-1)
 
 #define SEPARATOR ','
 #define QUERY '_'
+#define ITEMQUERY '#'
 
 char* sdr_parse (char *buf, SDR *s);
 
 
+// pool of SDRs stored in two contiguous arrays, for large collections of SDRs (e.g. training sets)
+// members are ordinary SDRs, sdr_* and memory functions use them in place
+
+typedef struct
+	{
+	SDR	*sdr;		// members, the positions of sdr[i] are stored in a
+	int	*a;		// positions of all members, one member after the other
+	size_t	count, size,	// number of members, number of positions used in a
+		maxcount, maxsize;	// allocated lengths of sdr and a
+	int	n;		// dimension of the members
+	} SDRPool;
+
+SDRPool *sdrpool_new (int n, size_t count, int cap);	// pool of count empty SDRs of capacity cap
+void sdrpool_delete (SDRPool *);
+void sdrpool_clear (SDRPool *);				// remove all members, keeping the allocated memory
+
+SDR *sdrpool_add (SDRPool *, SDR *s, int cap);		// append a copy of s (not a member) with capacity cap >= s->p
+							// returns the member, the arrays may move: previous member pointers become invalid
+
+
+// ---------- Storage cells ----------
+
+// Cell width in bits, chosen when compiling the library (e.g. cc -DTM_CELLBITS=4 ...): 1-bit cells store
+// binary associations, 2-, 4- and 8-bit cells are saturating counters which also allow deleting associations.
+// With 1-bit cells, dyadicmemory_delete and triadicmemory_delete do nothing, as cells may be shared by other writes.
+// Memory usage grows with the cell width. TM_CELLBITS=8 corresponds to the counters of Version 1.
+
+#ifndef TM_CELLBITS
+#define TM_CELLBITS	1
+#endif
+
+#if TM_CELLBITS != 1 && TM_CELLBITS != 2 && TM_CELLBITS != 4 && TM_CELLBITS != 8
+#error "TM_CELLBITS must be 1, 2, 4 or 8"
+#endif
+
+#define TM_CELLMAX	((1 << TM_CELLBITS) - 1)	// counters saturate at this value
+
+
+// ---------- Query workspace (scratch buffers reused across queries) ----------
+
+typedef struct
+	{
+	int	*response, nresponse;		// response vector and its capacity
+	word	**rows; int nrows;		// storage rows collected by a query
+	int	*hist, nhist;			// value histogram used to binarize the response
+	uint16_t *counts;			// overlap counters of item memory queries, zero between queries
+	int	*cursors, ncursors;		// positions in the item lists and candidates of a query
+	} Workspace;
+
+Workspace *workspace_new (void);		// create once per thread and pass to the _ex query functions
+void workspace_delete (Workspace *);
+
+
 // ---------- DyadicMemory (stores hetero-associations x-> y) ----------
 
 typedef uint8_t byte;				// represents 8 memory storage locations
 
-#define NMAX 20000 // largest possible value for nx
+typedef struct
+	{
+	int i,			// smaller bit of the address pair (i,j)
+	    n;			// storage row format: sorted list of n positions (n >= 0), or bitmap (n < 0)
+				// a position occurs in a list as often as its counter value
+	void *row;		// storage row, 0 for an empty slot
+	} DyadicSlot;
 
 typedef struct
 	{
-	byte **C;		// pointers to base triangle of half storage "cube"
+	DyadicSlot *slot;	// hash table of the pairs (i,j) stored so far, open addressing
+	int n, size,		// number of pairs, table size (0 or a power of 2)
+	    shift;		// 32 - log2(size), the hash of i is taken from the top bits of i * 2654435761
+	} DyadicLeaf;
+
+typedef struct
+	{
+	DyadicLeaf *C;		// directory of the bit-pair addresses of x: C[j] holds the rows of pairs (i,j), i < j
+				// storage rows are allocated as needed
+	
+	byte *slab;		// arena for storage rows, allocated in slabs
+	size_t slabfree;	// bytes left in the current slab
+	int rowbytes,		// size of a bitmap plane, ny bits padded to whole 64-bit words (TM_CELLBITS planes per bitmap)
+	    listmax;		// capacity of a sorted list, rows with more positions are stored as bitmaps
+	void *freelists;	// lists released when their rows became bitmaps, for reuse
 
 	int 	nx, ny,		// vector dimensions of x and y
 		p; 		// target sparse population of y
@@ -80,32 +188,226 @@ typedef struct
 DyadicMemory *dyadicmemory_new (int nx, int ny, int p);
 
 void dyadicmemory_write 	(DyadicMemory *, SDR *, SDR *);
+void dyadicmemory_delete 	(DyadicMemory *, SDR *, SDR *);		// decrement the counters of a write, no-op with 1-bit cells
 SDR* dyadicmemory_read 		(DyadicMemory *, SDR *, SDR *);
 SDR* dyadicmemory_read_p 	(DyadicMemory *, SDR *, SDR *, int);
 
+SDR* dyadicmemory_read_ex 	(DyadicMemory *, SDR *, SDR *, Workspace *);	// allocation-free queries
+SDR* dyadicmemory_read_p_ex 	(DyadicMemory *, SDR *, SDR *, int, Workspace *);
+
+
+
+// ---------- Thread pool (worker threads for large queries) ----------
+
+typedef struct ThreadPool ThreadPool;
+
+ThreadPool *threadpool_new (int nthreads, const int *cpus);	// cpus: 0, or nthreads CPU numbers to pin workers to (Linux)
+								// returns 0 if nthreads < 1 or no worker could be started
+void threadpool_delete (ThreadPool *);
+
+int threadpool_spread_cpus (int *cpus, int n);	// fill cpus[0..n-1] with CPUs taken from the NUMA nodes in turn, 0 if unknown
 
 
 // ---------- TriadicMemory (stores triple associations (x,y,z} ) ----------
 
 
+// storage options for triadicmemory_new_flags
+
+#define TM_ORIENTED	1	// keep x-, y- and z-major copies of the cube: 3x memory, equally fast reads of x, y and z
+#define TM_CONCURRENT	2	// allow concurrent writes and reads from several threads
+#define TM_SPARSE	4	// allocate storage pages on first write, reads skip pages that were never written
+#define TM_HUGEPAGES	8	// back the storage with 2 MB pages if the system provides them (Linux), see triadicmemory_backing
+#define TM_INTERLEAVE	16	// distribute the storage pages round-robin across NUMA nodes (Linux)
+
+// Concurrent mode: writes set (and forgetting clears) bits with atomic fetch-or (fetch-and) on 64-bit words,
+// and counters wider than one bit are updated with an atomic fetch-xor per bit plane, so that no updates
+// are lost when several threads write at the same time. Reads take no locks and run concurrently with
+// writes. Memory ordering is relaxed: a read running at the same time as a write may see any subset of
+// the bits of that triple, while writes that happen-before a read (e.g. through a mutex, a thread join
+// or a release/acquire flag used by the caller) are fully visible to it.
+// Reads rely on aligned 64-bit loads being single-copy atomic, which holds on x86-64 and ARM64.
+// Each thread needs its own workspace (the read functions without workspace argument use one per thread).
+
+
+typedef struct
+	{
+	word *bits;		// contiguous storage, 0 for a paged cube
+	word **pages;		// page directory of a paged cube (TM_SPARSE), 0 for pages never written
+	
+	size_t	nrows,		// number of rows
+		npages;
+	int	rowlen,		// row length in bits, padded to whole 64-bit words
+		rowwords,	// words per row: TM_CELLBITS bit planes of rowlen bits
+		pagerows,	// rows per page
+		backing;	// pages obtained for contiguous storage: normal, transparent huge or explicit huge pages
+	} Cube;
+
+
 typedef struct
 	{
-	byte *C;		// storage "cube"
+	Cube C;			// storage "cube", rows of nz bits addressed by (x,y)
+	Cube Cx, Cy;		// transposed copies (TM_ORIENTED only), rows of nx bits addressed by (y,z)
+				// and rows of ny bits addressed by (x,z)
 		
 	int	nx, ny, nz,	// vector dimensions
 		px, py, pz,	// target sparse populations
-		forgetting; 	// whether to randomly forget information (off by default)
+		forgetting, 	// whether to randomly forget information (off by default)
+		flags;		// storage options
+	
+	double	decay;		// forgetting rate: locations decremented per location written (1 by default)
+	uint64_t rng,		// state of the random generator used for forgetting, can be set for reproducible runs
+		 debt;		// forgetting still due, in units of 1/65536 location
+		
+	ThreadPool *pool;	// optional worker threads, reads of large memories are split across them (0 by default)
 		
 	} TriadicMemory;
 
 
 TriadicMemory *triadicmemory_new  (int n, int p);
 TriadicMemory *triadicmemory_new3 (int nx, int px, int ny, int py, int nz, int pz);
+TriadicMemory *triadicmemory_new_flags (int nx, int px, int ny, int py, int nz, int pz, int flags);
+
+size_t triadicmemory_storage (TriadicMemory *);	// bytes of storage allocated so far
+const char* triadicmemory_backing (TriadicMemory *);	// "4 KB pages", "transparent huge pages" or "huge pages"
+
+void triadicmemory_prefault (TriadicMemory *);	// map all storage pages now, in parallel on the workers of T->pool
 
 void triadicmemory_write   (TriadicMemory *, SDR *, SDR *, SDR *);
+void triadicmemory_write_batch (TriadicMemory *, SDR **, SDR **, SDR **, int count);	// write count triples
+void triadicmemory_delete  (TriadicMemory *, SDR *, SDR *, SDR *);	// decrement the counters of a write, no-op with 1-bit cells
 
 SDR* triadicmemory_read_x  (TriadicMemory *, SDR *, SDR *, SDR *);
 SDR* triadicmemory_read_y  (TriadicMemory *, SDR *, SDR *, SDR *);
 SDR* triadicmemory_read_z  (TriadicMemory *, SDR *, SDR *, SDR *);
 
+SDR* triadicmemory_read_x_ex  (TriadicMemory *, SDR *, SDR *, SDR *, Workspace *);	// allocation-free queries
+SDR* triadicmemory_read_y_ex  (TriadicMemory *, SDR *, SDR *, SDR *, Workspace *);
+SDR* triadicmemory_read_z_ex  (TriadicMemory *, SDR *, SDR *, SDR *, Workspace *);
+
+// batch queries over arrays of count SDRs, e.g. read_z_batch(T, x, y, z, count) reads z[i] from x[i] and y[i]
+// queries are grouped by the storage rows they touch and distributed across the workers of T->pool
+
+void triadicmemory_read_x_batch  (TriadicMemory *, SDR **, SDR **, SDR **, int count);
+void triadicmemory_read_y_batch  (TriadicMemory *, SDR **, SDR **, SDR **, int count);
+void triadicmemory_read_z_batch  (TriadicMemory *, SDR **, SDR **, SDR **, int count);
+
+
+
+// ---------- ItemMemory (cleanup memory, finds the stored SDRs nearest to a query) ----------
+
+// Items are SDRs stored under ids chosen by the caller, e.g. the symbols of a codebook. An inverted index lists
+// the items having a bit at each position, so that a query only visits the items sharing a bit with it.
+
+typedef struct
+	{
+	int	*ids, n, size;		// ids of the items with a bit at this position (sorted), number, capacity
+	} ItemList;
+
+typedef struct
+	{
+	ItemList *bit;			// bit[i] lists the items with bit i set
+	SDR	**item;			// stored items by id, 0 for unused ids
+	int	n,			// dimension of the items
+		nitems,			// number of stored items
+		maxid;			// ids are smaller than maxid (length of item)
+	} ItemMemory;
+
+ItemMemory *itemmemory_new (int n);
+void itemmemory_delete (ItemMemory *);
+
+void itemmemory_insert (ItemMemory *, int id, SDR *);	// store a copy of an SDR under id >= 0, replacing an item with that id
+void itemmemory_remove (ItemMemory *, int id);
+SDR *itemmemory_item (ItemMemory *, int id);		// stored item, 0 if there is none
+
+// the k items with the largest overlap with x: stores their ids and overlaps by decreasing overlap,
+// smaller ids first at equal overlap, and returns their number (at most k, only items sharing a bit with x)
+
+int itemmemory_query (ItemMemory *, SDR *x, int k, int *ids, int *overlaps);
+int itemmemory_query_ex (ItemMemory *, SDR *x, int k, int *ids, int *overlaps, Workspace *);
+
+
+
+// ---------- Binary protocol of the command line tools ----------
+
+// Frames consist of a little-endian u32 length of the rest of the frame, a u32 request id, an opcode (requests) or
+// status (replies) byte, and a payload of varints (7 bits per byte, low bits first). An SDR is a varint count followed
+// by its 0-based positions, the first one as is and each further one as the gap to its predecessor.
+// Replies repeat the request id. Only queries, OP_SYNC and failed requests get a reply.
+
+enum
+	{
+	OP_SYNC,		// no payload, empty reply once preceding requests are processed
+	OP_WRITE,		// x, y, z (dyadic: x, y)
+	OP_DELETE,		// x, y, z (dyadic: x, y), only with counter cells (TM_CELLBITS > 1)
+	OP_READ_X,		// y, z; reply: x
+	OP_READ_Y,		// x, z (dyadic: x); reply: y
+	OP_READ_Z,		// x, y; reply: z
+	OP_ITEMS_X,		// k and the SDRs of the read; reply: count and ids of the nearest items to the result, best first
+	OP_ITEMS_Y,
+	OP_ITEMS_Z,
+	OP_ITEM_STORE,		// id, SDR
+	OP_ITEM_REMOVE		// id
+	};
+	
+enum { STATUS_OK, STATUS_ERROR };	// error replies carry a message text as payload
+
+
+typedef struct
+	{
+	int	in, out;			// file descriptors
+	unsigned char *ibuf, *obuf;		// input and output buffers
+	size_t	isize, ipos, iend;		// input buffer capacity, start and end of unread input
+	size_t	osize, olen, frame;		// output buffer capacity, bytes pending, start of the frame being built
+	
+	uint32_t id;				// request id of the frame received last
+	int	code;				// its opcode or status
+	unsigned char *p, *end;			// its unread payload
+	} Channel;
+
+Channel *channel_new (int in, int out);
+void channel_delete (Channel *);		// flushes pending output
+
+int channel_receive (Channel *);		// next frame, 0 at the end of input; output is flushed before input blocks
+int channel_get_uint (Channel *, uint32_t *);	// next varint of the frame, 0 if the payload is malformed
+int channel_get_sdr (Channel *, SDR *);		// 0 if malformed, or if positions are out of range or exceed the capacity
+
+void channel_begin (Channel *, uint32_t id, int code);	// start a frame
+void channel_put_uint (Channel *, uint32_t);
+void channel_put_sdr (Channel *, SDR *);
+void channel_end (Channel *);				// complete the frame
+void channel_error (Channel *, const char *message);	// error reply to the frame received last
+void channel_flush (Channel *);
+
+
+
+// ---------- Batch mode of the command line tools ----------
+
+// Lines are taken from a memory-mapped file, or from stdin read in large blocks, without a limit on their length.
+
+typedef struct
+	{
+	int	fd;
+	char	*buf;				// input buffer, or the mapped file
+	size_t	size, start, end;		// buffer capacity, start and end of the unprocessed input
+	int	mapped, eof;
+	} TextInput;
+
+TextInput *textinput_open (const char *path);	// "-" for stdin, 0 if the file can't be opened
+void textinput_close (TextInput *);
+char *textinput_line (TextInput *, char **end);	// next line and its end (after the newline, if any), 0 at the end of input
+
+// sdr_scan parses positions like sdr_parse, from buf up to end, and returns where it stopped. It returns 0 instead
+// of reporting errors (positions out of range or exceeding the capacity), so that callers can fall back to sdr_parse.
+
+const char *sdr_scan (const char *buf, const char *end, SDR *s);
+char *sdr_format (char *out, SDR *s);		// writes s as sdr_print does to out (11 bytes per position and 1), returns the end
+
+
+
+// ---------- CPU dispatch ----------
+
+// Hot kernels are selected at program startup according to the processor's instruction set.
+// The environment variable TRIADICMEMORY_SIMD=portable|avx2|avx512 can force a lower level.
+
+const char* triadicmemory_simd (void);		// name of the selected instruction set level
 
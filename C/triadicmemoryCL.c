@@ -34,7 +34,7 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 
 static int VERSIONMAJOR = 2;
-static int VERSIONMINOR = 0;
+static int VERSIONMINOR = 1;
 
 
 static void print_help(void)
@@ -45,7 +45,9 @@ static void print_help(void)
 		
 	printf("\n");
 	printf("Command line arguments:\n\n");
-	printf("triadicmemory n p            (n is the vector dimension, p is the vector's target sparse population)\n\n");
+	printf("triadicmemory n p            (n is the vector dimension, p is the vector's target sparse population)\n");
+	printf("triadicmemory -b n p         (binary protocol on stdin and stdout, see README.md, instead of the text input below)\n");
+	printf("triadicmemory -f file n p    (batch mode: processes the lines of a file, or of stdin if file is -, at full speed)\n\n");
 		
 		
 	printf("Usage examples:\n\n");
@@ -61,6 +63,21 @@ static void print_help(void)
 	printf("Recall z:\n\n");
 	printf("{37 195 355 371 471 603 747 914 943 963, 73 252 418 439 461 469 620 625 902 922, _}\n\n");
 
+	printf("Recall z and print the id of the nearest stored item (#k prints the ids of the k nearest items, best first):\n");
+	printf("{37 195 355 371 471 603 747 914 943 963, 73 252 418 439 461 469 620 625 902 922, #}\n\n");
+
+	printf("Store an item with id 17, a vector to which query results can be mapped by #:\n");
+	printf("#17: 60 91 94 128 249 517 703 906 962 980\n\n");
+
+	printf("Remove item 17:\n");
+	printf("-#17\n\n");
+
+	if (TM_CELLBITS > 1) // deleting needs counters, 1-bit cells are shared by other associations
+		{
+		printf("Delete {x,y,z} from memory:\n");
+		printf("-{37 195 355 371 471 603 747 914 943 963, 73 252 418 439 461 469 620 625 902 922, 60 91 94 128 249 517 703 906 962 980}\n\n");
+		}
+
 	printf("Generate a random vector:\n");
 	printf("random\n\n");
 
@@ -75,82 +92,403 @@ static void print_help(void)
 	}
 	
 	
+static int topk; // number of item ids to print for a query marked by #
+
+
 static char* parse (char *buf, SDR *s)
 	{
 	buf = sdr_parse(buf, s);
 	
 	if (*buf == QUERY && s->p == 0)  { s->p = -1; buf++; while (isspace(*buf)) buf++;}
 	
+	else if (*buf == ITEMQUERY && s->p == 0) // query returning item ids, #k for the k nearest items
+		{
+		char *end;
+		s->p = -2;
+		topk = strtol(++buf, &end, 10);
+		if (end == buf) topk = 1;
+		buf = end;
+		while (isspace(*buf)) buf++;
+		}
+	
 	if (*buf == SEPARATOR) buf++;
 	
 	return buf;
 	}
+	
+	
+static void print_items (ItemMemory *I, SDR *s, int k) // ids of the k items nearest to s, best first
+	{
+	if (k > I->nitems) k = I->nitems; // no more ids than items
+	if (k < 0) k = 0;
+	
+	int *ids = malloc((k ? k : 1) * sizeof(int)), *overlaps = malloc((k ? k : 1) * sizeof(int));
+	if (! ids || ! overlaps)
+		{ printf("out of memory\n"); exit(6); }
+		
+	int found = itemmemory_query(I, s, k, ids, overlaps);
+	
+	for (int i = 0; i < found; i++)
+		printf(i ? " %d" : "%d", ids[i]);
+	printf("\n");
+	fflush(stdout);
+	
+	free(ids);
+	free(overlaps);
+	}
+	
+static void print_result (ItemMemory *I, SDR *s, int items)
+	{
+	if (items)
+		print_items(I, s, topk);
+	else
+		sdr_print(s);
+	}
 
 
-int main(int argc, char *argv[])
+static void reply (Channel *C, ItemMemory *I, SDR *s, int items, uint32_t k) // s, or the ids of the k nearest items
 	{
-	char *buf, inputline[10000];
+	if (! items)
+		{
+		channel_begin(C, C->id, STATUS_OK);
+		channel_put_sdr(C, s);
+		channel_end(C);
+		return;
+		}
+		
+	if (k > (uint32_t) I->nitems) k = I->nitems;
+	int *ids = malloc((k ? k : 1) * sizeof(int)), *overlaps = malloc((k ? k : 1) * sizeof(int));
 	
-	if (argc != 3)
+	if (! ids || ! overlaps)
+		channel_error(C, "out of memory");
+	else
 		{
-		print_help();
-		exit(1);
+		int found = itemmemory_query(I, s, k, ids, overlaps);
+		
+		channel_begin(C, C->id, STATUS_OK);
+		channel_put_uint(C, found);
+		for (int i = 0; i < found; i++)
+			channel_put_uint(C, ids[i]);
+		channel_end(C);
 		}
-        
-	int N, P;  // SDR dimension and target sparse population, received from command line
+		
+	free(ids);
+	free(overlaps);
+	}
+	
+	
+static void serve (TriadicMemory *T, ItemMemory *I, SDR **v) // binary protocol, v holds x, y and z
+	{
+	SDR* (*read[3]) (TriadicMemory *, SDR *, SDR *, SDR *) = { triadicmemory_read_x, triadicmemory_read_y, triadicmemory_read_z };
+	Channel *C = channel_new(0, 1);
+	
+	while (channel_receive(C))
+		{
+		int op = C->code, ok = 1, items = op >= OP_ITEMS_X && op <= OP_ITEMS_Z;
+		int q = items ? op - OP_ITEMS_X : op - OP_READ_X; // queried part of a read
+		uint32_t k = 1, id = 0;
+		
+		// parse the request
+		
+		if (op == OP_DELETE && TM_CELLBITS == 1)
+			{
+			channel_error(C, "delete needs counter cells (TM_CELLBITS > 1)");
+			continue;
+			}
+			
+		if (op == OP_WRITE || op == OP_DELETE)
+			for (int i = 0; i < 3 && ok; i++)
+				ok = channel_get_sdr(C, v[i]);
+				
+		else if (op >= OP_READ_X && op <= OP_ITEMS_Z)
+			{
+			if (items) ok = channel_get_uint(C, &k);
+			for (int i = 0; i < 3 && ok; i++)
+				if (i != q) ok = channel_get_sdr(C, v[i]);
+			}
+			
+		else if (op == OP_ITEM_STORE || op == OP_ITEM_REMOVE)
+			{
+			ok = channel_get_uint(C, &id) && id <= 1 << 30;
+			if (ok && op == OP_ITEM_STORE) ok = channel_get_sdr(C, v[0]);
+			}
+			
+		else if (op != OP_SYNC)
+			{
+			channel_error(C, "unknown opcode");
+			continue;
+			}
+			
+		if (! ok || C->p != C->end)
+			{
+			channel_error(C, "invalid request");
+			continue;
+			}
+			
+		// execute it
+		
+		if (op == OP_WRITE)
+			triadicmemory_write (T, v[0], v[1], v[2]);
+			
+		else if (op == OP_DELETE)
+			triadicmemory_delete (T, v[0], v[1], v[2]);
+			
+		else if (op >= OP_READ_X && op <= OP_ITEMS_Z)
+			reply(C, I, read[q](T, v[0], v[1], v[2]), items, k);
+			
+		else if (op == OP_ITEM_STORE)
+			itemmemory_insert(I, id, v[0]);
+			
+		else if (op == OP_ITEM_REMOVE)
+			itemmemory_remove(I, id);
+			
+		else // OP_SYNC
+			{
+			channel_begin(C, C->id, STATUS_OK);
+			channel_end(C);
+			}
+		}
+		
+	channel_delete(C);
+	}
 
-	sscanf( argv[1], "%d", &N);
-	sscanf( argv[2], "%d", &P);
-   
-   	TriadicMemory *T = triadicmemory_new(N, P);
-    	
-	SDR *x = sdr_new(N);
-	SDR *y = sdr_new(N);
-	SDR *z = sdr_new(N);
+
+static TriadicMemory *T;
+static ItemMemory *I;
+static SDR *x, *y, *z;
+static int N, P;  // SDR dimension and target sparse population, received from command line
+
+
+static int execute (char *inputline) // process a line of input, 0 for quit
+	{
+	char *buf;
 	
-	while (	fgets(inputline, sizeof(inputline), stdin) != NULL)
+	if (! strcmp(inputline, "quit\n"))
+		return 0;
+
+	if (! strcmp(inputline, "help\n"))
+		print_help();
+
+	else if (! strcmp(inputline, "random\n"))
+		sdr_print(sdr_random(x, P));
+
+	else if ( strcmp(inputline, "version\n") == 0)
+		printf("triadicmemory %d.%d\n", VERSIONMAJOR, VERSIONMINOR);
+		
+	else if (*inputline == ITEMQUERY || ! strncmp(inputline, "-#", 2)) // store or remove an item
 		{
-		if (! strcmp(inputline, "quit\n"))
-			exit(0);
+		int delete = *inputline == '-';
+		buf = inputline + delete + 1;
+		long id = strtol(buf, &buf, 10);
+		
+		if (buf == inputline + delete + 1 || id < 0 || id > 1 << 30)
+			{ printf("invalid item id: %s\n", inputline); exit(4); }
+		
+		if (delete)
+			itemmemory_remove(I, id);
+		else if (*buf == ':')
+			{
+			sdr_parse(buf+1, x);
+			itemmemory_insert(I, id, x);
+			}
+		else
+			{ printf("expecting ':', found %s\n", inputline); exit(4); }
+		}
+		
+	else // parse input of the form { 1 2 3, 4 5 6, 7 8 9 }
+		{
+		int delete = 0;
+		buf = inputline;
+		
+		if (*buf == '-')
+			{ delete = 1; ++buf; }
+		
+		if (delete && TM_CELLBITS == 1)
+			{ printf("invalid input, delete needs counter cells (TM_CELLBITS > 1)\n"); exit(3); }
+		
+		if (*buf != '{')
+			{ printf("expecting '{', found %s\n ", inputline); exit(4); }
+	
+		buf = parse(parse(parse(buf+1, x), y), z);
+	
+		if( *buf != '}')
+			{ printf("expecting '}', found %s\n ", inputline); exit(4); }
 	
-		if (! strcmp(inputline, "help\n"))
-			print_help();
+		int items = x->p == -2 || y->p == -2 || z->p == -2; // print item ids instead of the result
+		
+		if ( x->p >= 0 && y->p >= 0 && z->p >= 0) // write or delete x, y, z
+			{
+			if (delete == 0) // write
+				triadicmemory_write  (T, x, y, z);
+			else // delete
+				triadicmemory_delete (T, x, y, z);
+			}
+			
+		else if ( x->p >= 0 && y->p >= 0 && z->p < 0) // read z
+			print_result( I, triadicmemory_read_z (T, x, y, z), items);
+			
+		else if ( x->p >= 0 && y->p < 0 && z->p >= 0) // read y
+			print_result( I, triadicmemory_read_y (T, x, y, z), items);
 
-		else if (! strcmp(inputline, "random\n"))
-			sdr_print(sdr_random(x, P));
+		else if ( x->p < 0 && y->p >= 0 && z->p >= 0) // read x
+			print_result( I, triadicmemory_read_x (T, x, y, z), items);
 
-		else if ( strcmp(inputline, "version\n") == 0)
-			printf("triadicmemory %d.%d\n", VERSIONMAJOR, VERSIONMINOR);
+		else
+			{ printf("invalid input\n"); exit(3); }
+		}
+		
+	return 1;
+	}
+	
+	
+// batch mode: runs of writes or reads are collected and processed by the batch functions,
+// all other lines are flushed in order and go to execute
+
+#define BATCH 1024
+
+static SDRPool *pending;	// x, y and z of the pending lines
+static int npending;
+static char kind[BATCH];	// 0, 1, 2 for reads of x, y, z, 3 for writes
+static char *text;		// output line
+
+
+static void flush (void)
+	{
+	void (*read[3]) (TriadicMemory *, SDR **, SDR **, SDR **, int) =
+		{ triadicmemory_read_x_batch, triadicmemory_read_y_batch, triadicmemory_read_z_batch };
+	SDR *v[3][BATCH];
+	
+	for (int q = 0; q < 4; q++)
+		{
+		int m = 0;
+		
+		for (int i = 0; i < npending; i++)
+			if (kind[i] == q)
+				{
+				for (int j = 0; j < 3; j++)
+					v[j][m] = pending->sdr + 3*i + j;
+				m++;
+				}
+				
+		if (m && q < 3)
+			read[q] (T, v[0], v[1], v[2], m);
+		else if (m)
+			triadicmemory_write_batch (T, v[0], v[1], v[2], m);
+		}
+		
+	for (int i = 0; i < npending; i++) // results in input order
+		if (kind[i] < 3)
+			fwrite(text, 1, sdr_format(text, pending->sdr + 3*i + kind[i]) - text, stdout);
 			
-		else // parse input of the form { 1 2 3, 4 5 6, 7 8 9 }
+	sdrpool_clear(pending);
+	npending = 0;
+	}
+	
+	
+static int queue (const char *line, const char *end) // queue a plain write or read, 0 for other lines
+	{
+	SDR *v[3] = {x, y, z};
+	int q = 3;
+	
+	if (*line != '{') return 0;
+	line++;
+	
+	for (int j = 0; j < 3; j++) // as parse, but accepting only well-formed input
+		{
+		if (! (line = sdr_scan(line, end, v[j]))) return 0;
+		
+		if (line < end && *line == QUERY && v[j]->p == 0 && q == 3)
 			{
-			buf = inputline;
+			q = j;
+			for (line++; line < end && isspace(*line); line++) ;
+			}
 			
-			if (*buf != '{')
-				{ printf("expecting '{', found %s\n ", inputline); exit(4); }
+		if (line == end || *line++ != (j < 2 ? SEPARATOR : '}')) return 0;
+		}
 		
-			buf = parse(parse(parse(buf+1, x), y), z);
+	if (npending && (kind[0] == 3) != (q == 3)) // reads see the writes before them
+		flush();
 		
-			if( *buf != '}')
-				{ printf("expecting '}', found %s\n ", inputline); exit(4); }
+	for (int j = 0; j < 3; j++)
+		sdrpool_add(pending, v[j], j == q ? N : 0);
 		
-			if ( x->p >= 0 && y->p >= 0 && z->p >= 0) // write x, y, z
-				triadicmemory_write  (T, x, y, z);
-				
-			else if ( x->p >= 0 && y->p >= 0 && z->p == -1) // read z
-				sdr_print( triadicmemory_read_z (T, x, y, z));
-				
-			else if ( x->p >= 0 && y->p == -1 && z->p >= 0) // read y
-				sdr_print( triadicmemory_read_y (T, x, y, z));
+	kind[npending++] = q;
+	if (npending == BATCH) flush();
+	return 1;
+	}
+	
+	
+static void batch (const char *path)
+	{
+	TextInput *in = textinput_open(path);
+	if (! in) { perror(path); exit(1); }
+	
+	setvbuf(stdout, 0, _IOFBF, 1 << 22);
+	pending = sdrpool_new(N, 0, 0);
+	text = malloc(11 * N + 1);
+	
+	char *line, *end, *copy = 0;
+	size_t size = 0;
+	
+	while ((line = textinput_line(in, &end)))
+		{
+		if (queue(line, end)) continue;
+		
+		flush();
+		
+		size_t len = end - line;
+		
+		if (len + 1 > size) copy = realloc(copy, size = 2 * (len + 1));
+		memcpy(copy, line, len);
+		copy[len] = 0;
+		
+		if (! execute(copy)) break;
+		}
+		
+	flush();
+	textinput_close(in);
+	}
 
-			else if ( x->p == -1 && y->p >= 0 && z->p >= 0) // read x
-				sdr_print( triadicmemory_read_x (T, x, y, z));
 
-			else
-				{ printf("invalid input\n"); exit(3); }
-			}
+int main(int argc, char *argv[])
+	{
+	char inputline[10000], *file = 0;
+	int binary = 0;
+	
+	for (; argc > 3 && *argv[1] == '-'; argc--, argv++) // options
+		{
+		if (! strcmp(argv[1], "-b"))
+			binary = 1;
+		else if (! strcmp(argv[1], "-f"))
+			{ file = argv[2]; argc--; argv++; }
+		else
+			break;
+		}
+	
+	if (argc != 3)
+		{
+		print_help();
+		exit(1);
 		}
+        
+	sscanf( argv[1], "%d", &N);
+	sscanf( argv[2], "%d", &P);
+   
+   	T = triadicmemory_new(N, P);
+   	I = itemmemory_new(N);
+    	
+	x = sdr_new(N);
+	y = sdr_new(N);
+	z = sdr_new(N);
+	
+	if (binary)
+		serve(T, I, (SDR*[]) {x, y, z});
+		
+	else if (file)
+		batch(file);
+		
+	else while (fgets(inputline, sizeof(inputline), stdin) != NULL && execute(inputline))
+		;
 			
 	return 0;
 	}
-	
@@ -44,20 +44,43 @@ int main(int argc, char *argv[])
     	int items 		= 100000;
     	int iterations 		= 10;
     	int tridirectional 	= 1;
+    	int flags		= 0;	// set to TM_ORIENTED for equally fast x, y and z reads at 3x memory,
+    					// add TM_SPARSE to allocate storage pages on first write,
+    					// or TM_HUGEPAGES for 2 MB page backing (can be given as first argument)
+    	int threads		= 0;	// number of worker threads for splitting large reads (0 = single-threaded)
+    	int batch		= 0;	// set to 1 to use the batch write and read functions
+    	int prefault		= 0;	// set to 1 to map all storage pages before the first write
 
   	clock_t start;
   	
+  	if (argc > 1)
+  		flags = atoi(argv[1]); // e.g. 0 and 8 compare 4 KB and 2 MB page backing
+  	
   	int* h = (int *)malloc(items * sizeof(int)); // stores Hamming distances for test set
  	double meanhammingdistance;
  	
-   	TriadicMemory *T = triadicmemory_new(N, P);
+   	TriadicMemory *T = triadicmemory_new_flags(N, P, N, P, N, P, flags);
    	
    	T->forgetting = 0; // set to 1 to enable forgetting mode
+   	
+   	if (threads > 0) // workers pinned to CPUs of all NUMA nodes in turn
+   		{
+   		int *cpus = malloc(threads * sizeof(int));
+   		T->pool = threadpool_new(threads, threadpool_spread_cpus(cpus, threads) ? cpus : 0);
+   		free(cpus);
+   		}
+   		
+   	if (prefault)
+   		triadicmemory_prefault(T);
   	
 	printf("Triadic Memory performance and capacity test");
 	if (T->forgetting)
-		printf(" (random forgetting enabled)");
-	printf("\n");
+		printf(" (random forgetting enabled, decay %g)", T->decay);
+	if (T->flags & TM_ORIENTED)
+		printf(" (x-, y- and z-major storage)");
+	if (T->flags & TM_SPARSE)
+		printf(" (paged storage)");
+	printf(", %s kernels, %s\n", triadicmemory_simd(), triadicmemory_backing(T));
   	
 	
 	SDR **t1 	= malloc(items * sizeof(SDR*));
@@ -65,12 +88,16 @@ int main(int argc, char *argv[])
 	SDR **t3 	= malloc(items * sizeof(SDR*));
 	SDR **out 	= malloc(items * sizeof(SDR*));
 
+	// the test data pools hold 4 bytes per position instead of 4 bytes per dimension
+	SDRPool *data = sdrpool_new(N, 3 * items, P);
+	SDRPool *results = sdrpool_new(N, items, N);	// room for all N positions, a read is never truncated
+
 	for (int i = 0; i < items; i++)
 		{
-		t1[i] = sdr_new(N);
-		t2[i] = sdr_new(N);
-		t3[i] = sdr_new(N);
-		out[i]= sdr_new(N);
+		t1[i] = data->sdr + i;
+		t2[i] = data->sdr + items + i;
+		t3[i] = data->sdr + 2 * items + i;
+		out[i]= results->sdr + i;
 		}
 		
 	for (int iter = 1; iter <= iterations; iter ++)
@@ -90,7 +117,9 @@ int main(int argc, char *argv[])
 	
 		printf("write/sec ");
 		start = clock();
-		for (int i = 0; i < items; i++)
+		if (batch)
+			triadicmemory_write_batch( T, t1, t2, t3, items);
+		else for (int i = 0; i < items; i++)
 			triadicmemory_write( T, t1[i],t2[i],t3[i]);
 	
 		PrintOpsPerSecond;
@@ -100,7 +129,9 @@ int main(int argc, char *argv[])
 		printf("z read/sec ");
 		start = clock();
 		
-		for (int i = 0; i < items; i++)
+		if (batch)
+			triadicmemory_read_z_batch ( T, t1, t2, out, items );
+		else for (int i = 0; i < items; i++)
 			triadicmemory_read_z ( T, t1[i], t2[i], out[i] );
 		
 		PrintOpsPerSecond;
@@ -118,7 +149,9 @@ int main(int argc, char *argv[])
 		printf("y read/sec ");
 		start = clock();
 		
-		for (int i = 0; i < items; i++)
+		if (batch)
+			triadicmemory_read_y_batch ( T, t1, out, t3, items );
+		else for (int i = 0; i < items; i++)
 			triadicmemory_read_y ( T, t1[i], out[i], t3[i] );
 		PrintOpsPerSecond;
 
@@ -132,7 +165,9 @@ int main(int argc, char *argv[])
 		printf("x read/sec ");
 		start = clock();
 		
-		for (int i = 0; i < items; i++)
+		if (batch)
+			triadicmemory_read_x_batch ( T, out, t2, t3, items );
+		else for (int i = 0; i < items; i++)
 			triadicmemory_read_x ( T, out[i], t2[i], t3[i] );
 		
 		PrintOpsPerSecond;
@@ -140,7 +175,7 @@ int main(int argc, char *argv[])
 		// calculate hamming distances
 		for (int i = 0; i < items; i++) h[i] = sdr_distance(t1[i], out[i]);
 		meanhammingdistance = 0; for (int i = 0; i < items; i++) meanhammingdistance += h[i];
-		printf("%.3f avg dist | \n", meanhammingdistance/items);
+		printf("%.3f avg dist | %d MB |\n", meanhammingdistance/items, (int)(triadicmemory_storage(T) >> 20));
 		}
 		
 	printf("\n");